@@ -2,15 +2,74 @@
 
 #include <pxr/base/gf/matrix4f.h>
 
+namespace {
+
+// Light color and quad converted by Sync, moved into the delegate light by UpdateScene.
+struct HdLighthouse2AreaLightUpdate final : public HdLighthouse2RenderDelegate::SceneUpdate
+{
+    HdLighthouse2Handle handle;
+    HdLighthouse2Handle material;
+    float3 color;
+
+    bool hasQuad = false;
+    std::vector<int> indices;
+    std::vector<float3> vertices;
+    std::vector<float3> normals;
+
+    bool hasTransform = false;
+    mat4 transform;
+
+    virtual void Apply(HdLighthouse2RenderDelegate& i_delegate) override
+    {
+        auto& mesh = i_delegate.GetLight(handle);
+        auto& ltMat = i_delegate.GetMaterial(material);
+        mesh.material = material;
+
+        // apply new color
+        //
+        ltMat.material->color = color;
+        ltMat.material->metallic = HostMaterial::ScalarValue(0.0f);
+        ltMat.material->roughness = HostMaterial::ScalarValue(0.0f);
+        ltMat.material->specular = HostMaterial::ScalarValue(0.0f);
+
+        if (hasQuad)
+        {
+            mesh.dirtyMesh = true;
+            mesh.indices.swap(indices);
+            mesh.vertices.swap(vertices);
+            mesh.normals.swap(normals);
+
+            // uvs are baked in the triangles with the first build
+            if (mesh.mesh->ID == -1)
+                mesh.uvs.assign(6, make_float2(0, 0));
+        }
+
+        if (hasTransform)
+        {
+            mesh.dirtyTransform = true;
+            mesh.newTransforms.assign(1, transform);
+        }
+        i_delegate.MarkLightDirty(handle, mesh);
+    }
+};
+
+} // anonymous namespace
+
 
 HdLighthouse2AreaLight::HdLighthouse2AreaLight(
     SdfPath const& rprimId, HdLighthouse2RenderDelegate* renderDelegate) :
     HdLight(rprimId), _owner(renderDelegate)
 {
+    // material and light-mesh pointing at the same id/assetpath
+    std::lock_guard<std::mutex> guard(_owner->rendererMutex());
+    _handle = _owner->CreateLight();
+    _materialHandle = _owner->GetMaterialHandle(rprimId);
 }
 
 HdLighthouse2AreaLight::~HdLighthouse2AreaLight()
 {
+    _owner->DestroyLight(_handle);
+    _owner->DestroyMaterial(_materialHandle);
 }
 
 HdDirtyBits HdLighthouse2AreaLight::GetInitialDirtyBitsMask() const
@@ -27,7 +86,10 @@ void HdLighthouse2AreaLight::Sync(
 
     const auto& id = GetId();
 
-    std::lock_guard<std::mutex> guard(_owner->rendererMutex());
+    // converted without any lock, the delegate applies it in UpdateScene
+    std::unique_ptr<HdLighthouse2AreaLightUpdate> update(new HdLighthouse2AreaLightUpdate());
+    update->handle = _handle;
+    update->material = _materialHandle;
 
     // this will always update the material attached to the light
     // to change its intensity/exposure/color
@@ -57,81 +119,43 @@ void HdLighthouse2AreaLight::Sync(
     }
     auto lightFinalColor = make_float3(lightColor[0] * intensity, lightColor[1] * intensity, lightColor[2] * intensity);
 
-    // material and light-mesh pointing at the same id/assetpath
-    auto& mesh = _owner->GetLight(id);
-    auto& ltMat = _owner->GetMaterial(id, lightFinalColor);
-    _owner->BindMeshToMaterial(id, id);
-
-    // apply new color
-    //
-    ltMat.material->color = lightFinalColor;
-    ltMat.material->metallic = HostMaterial::ScalarValue(0.0f);
-    ltMat.material->roughness = HostMaterial::ScalarValue(0.0f);
-    ltMat.material->specular = HostMaterial::ScalarValue(0.0f);
+    update->color = lightFinalColor;
 
-    // create quad if needed
+    // (re)stage the quad, staging is released once the light is uploaded
     //
-    if (mesh.indices.size() == 0 || mesh.vertices.size() == 0)
+    if (*dirtyBits & (DirtyParams))
     {
+        update->hasQuad = true;
+
         // Make sure we have all triangles
-        mesh.indices.emplace_back(0);
-        mesh.indices.emplace_back(1);
-        mesh.indices.emplace_back(2);
-        mesh.indices.emplace_back(3);
-        mesh.indices.emplace_back(4);
-        mesh.indices.emplace_back(5);
-
-        mesh.vertices.emplace_back(make_float3(-width / 2.0, -height / 2.0, 0));
-        mesh.vertices.emplace_back(make_float3(-width / 2.0, height / 2.0, 0));
-        mesh.vertices.emplace_back(make_float3(width / 2.0, -height / 2.0, 0));
-
-        mesh.vertices.emplace_back(make_float3(width / 2.0, -height / 2.0, 0));
-        mesh.vertices.emplace_back(make_float3(-width / 2.0, height / 2.0, 0));
-        mesh.vertices.emplace_back(make_float3(width / 2.0, height / 2.0, 0));
-
-        const auto& n = make_float3(0, -1, 0);
-        mesh.normals.emplace_back(n);
-        mesh.normals.emplace_back(n);
-        mesh.normals.emplace_back(n);
-        mesh.normals.emplace_back(n);
-        mesh.normals.emplace_back(n);
-        mesh.normals.emplace_back(n);
-
-        const auto& uv = make_float2(0, 0);
-        mesh.uvs.emplace_back(uv);
-        mesh.uvs.emplace_back(uv);
-        mesh.uvs.emplace_back(uv);
-        mesh.uvs.emplace_back(uv);
-        mesh.uvs.emplace_back(uv);
-        mesh.uvs.emplace_back(uv);
-    }
-    else
-    {
-        if (*dirtyBits & (DirtyParams))
-        {
-            mesh.dirtyMesh = true;
-            mesh.vertices[0] = make_float3(-width / 2.0, -height / 2.0, 0);
-            mesh.vertices[1] = (make_float3(-width / 2.0, height / 2.0, 0));
-            mesh.vertices[2] = (make_float3(width / 2.0, -height / 2.0, 0));
-            mesh.vertices[3] = (make_float3(width / 2.0, -height / 2.0, 0));
-            mesh.vertices[4] = (make_float3(-width / 2.0, height / 2.0, 0));
-            mesh.vertices[5] = (make_float3(width / 2.0, height / 2.0, 0));
-        }
+        update->indices.resize(6);
+        for (int i = 0; i < 6; ++i)
+            update->indices[i] = i;
+
+        update->vertices.resize(6);
+        update->vertices[0] = make_float3(-width / 2.0, -height / 2.0, 0);
+        update->vertices[1] = make_float3(-width / 2.0, height / 2.0, 0);
+        update->vertices[2] = make_float3(width / 2.0, -height / 2.0, 0);
+        update->vertices[3] = make_float3(width / 2.0, -height / 2.0, 0);
+        update->vertices[4] = make_float3(-width / 2.0, height / 2.0, 0);
+        update->vertices[5] = make_float3(width / 2.0, height / 2.0, 0);
+
+        update->normals.assign(6, make_float3(0, -1, 0));
     }
 
     // apply transform
     //
     if (*dirtyBits & (DirtyTransform))
     {
-        mesh.dirtyTransform = true;
+        update->hasTransform = true;
         const auto& transposed = GfMatrix4f(delegate->GetTransform(id)).GetTranspose();
-        if (mesh.transforms.size() == 0)
-            mesh.transforms.resize(1);
         for (int i = 0; i < 16; ++i)
         {
-            mesh.transforms[0].cell[i] = transposed.data()[i];
+            update->transform.cell[i] = transposed.data()[i];
         }
     }
+
+    _owner->EnqueueSceneUpdate(std::move(update));
     
     if (dirtyBits) {
         *dirtyBits = HdChangeTracker::Clean;
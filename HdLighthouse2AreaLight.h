@@ -25,6 +25,8 @@ public:
 
 private:
     HdLighthouse2RenderDelegate* _owner;
+    HdLighthouse2Handle _handle;
+    HdLighthouse2Handle _materialHandle;
 };
 
 
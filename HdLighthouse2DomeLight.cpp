@@ -1,5 +1,39 @@
 #include "HdLighthouse2DomeLight.h"
 
+namespace {
+
+// Sky loaded by Sync, swapped into the scene by UpdateScene.
+struct HdLighthouse2DomeLightUpdate final : public HdLighthouse2RenderDelegate::SceneUpdate
+{
+    bool hasSky = false;
+    std::unique_ptr<HostSkyDome> sky; // nullptr removes the sky
+
+    bool hasTransform = false;
+    mat4 worldToLight;
+
+    virtual void Apply(HdLighthouse2RenderDelegate& i_delegate) override
+    {
+        HostScene* scene = i_delegate.GetRenderer()->GetScene();
+        if (hasSky)
+        {
+            // a new texture keeps the dome rotation, unless this update has one
+            if (sky != nullptr && scene->sky != nullptr)
+                sky->worldToLight = scene->sky->worldToLight;
+            delete scene->sky;
+            scene->sky = sky.release();
+            if (scene->sky != nullptr)
+                scene->sky->MarkAsDirty();
+        }
+
+        if (hasTransform && scene->sky != nullptr)
+        {
+            scene->sky->worldToLight = worldToLight;
+        }
+    }
+};
+
+} // anonymous namespace
+
 
 HdLighthouse2DomeLight::HdLighthouse2DomeLight(
     SdfPath const& rprimId, HdLighthouse2RenderDelegate* renderDelegate) :
@@ -9,11 +43,13 @@ HdLighthouse2DomeLight::HdLighthouse2DomeLight(
 
 HdLighthouse2DomeLight::~HdLighthouse2DomeLight()
 {
-    std::lock_guard<std::mutex> guard(_owner->rendererMutex());
-    if (_owner->GetRenderer()->GetScene()->sky != nullptr)
+    // back to an empty sky, the loaded one is freed by UpdateScene
+    if (!_environmentImageFilePath.empty())
     {
-        _owner->GetRenderer()->GetScene()->sky = new HostSkyDome();
-        _owner->GetRenderer()->GetScene()->sky->MarkAsDirty();
+        std::unique_ptr<HdLighthouse2DomeLightUpdate> update(new HdLighthouse2DomeLightUpdate());
+        update->hasSky = true;
+        update->sky.reset(new HostSkyDome());
+        _owner->EnqueueSceneUpdate(std::move(update));
     }
 }
 
@@ -30,35 +66,37 @@ void HdLighthouse2DomeLight::Sync(
     VtValue envFilePathVal = delegate->GetLightParamValue(id, pxr::HdLightTokens->textureFile);
     auto envFilePath = envFilePathVal.Get<pxr::SdfAssetPath>().GetResolvedPath();
 
+    // the hdr is loaded here, without any lock, the delegate only swaps it in
+    std::unique_ptr<HdLighthouse2DomeLightUpdate> update(new HdLighthouse2DomeLightUpdate());
+
     if (_environmentImageFilePath != envFilePath)
     {
-        std::lock_guard<std::mutex> guard(_owner->rendererMutex());
+        update->hasSky = true;
 
         _environmentImageFilePath = envFilePath;
         if (!_environmentImageFilePath.empty())
         {
             std::cout << "Creating dome " << _environmentImageFilePath << std::endl;
-            if (_owner->GetRenderer()->GetScene()->sky == nullptr)
-                _owner->GetRenderer()->GetScene()->sky = new HostSkyDome();
-            _owner->GetRenderer()->GetScene()->sky->Load(_environmentImageFilePath.c_str());
-            _owner->GetRenderer()->GetScene()->sky->MarkAsDirty();
-        }
-        else
-        {
-            delete _owner->GetRenderer()->GetScene()->sky;
+            update->sky.reset(new HostSkyDome());
+            update->sky->Load(_environmentImageFilePath.c_str());
         }
     }
 
     if (*dirtyBits & (DirtyTransform))
     {
-        std::lock_guard<std::mutex> guard(_owner->rendererMutex());
+        update->hasTransform = true;
 
         GfMatrix4d transposedIblXform = delegate->GetTransform(id).GetTranspose();
         for (int i = 0; i < 16; ++i)
         {
-            _owner->GetRenderer()->GetScene()->sky->worldToLight.cell[i] = transposedIblXform.data()[i];
+            update->worldToLight.cell[i] = transposedIblXform.data()[i];
         }
-        _owner->GetRenderer()->GetScene()->sky->worldToLight = mat4::RotateX(-PI / 2.0) * _owner->GetRenderer()->GetScene()->sky->worldToLight * mat4::RotateY((PI / 2.0) + (PI / 7.0));
+        update->worldToLight = mat4::RotateX(-PI / 2.0) * update->worldToLight * mat4::RotateY((PI / 2.0) + (PI / 7.0));
+    }
+
+    if (update->hasSky || update->hasTransform)
+    {
+        _owner->EnqueueSceneUpdate(std::move(update));
     }
 
     if (dirtyBits) {
@@ -1,24 +1,28 @@
-
 #include "HdLighthouse2Instancer.h"
 #include <pxr/imaging/hd/sceneDelegate.h>
+#include <pxr/imaging/hd/tokens.h>
 #include <pxr/base/gf/quath.h>
+#include <pxr/base/gf/quatd.h>
+#include <pxr/base/tf/hash.h>
+#include <algorithm>
 #include <iostream>
+#include <cstring> // memcpy
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
 
 PXR_NAMESPACE_USING_DIRECTIVE
 
+// instances per task in the transform loops
+static const size_t kInstanceGrainSize = 4096;
 
 HdLighthouse2Instancer::HdLighthouse2Instancer(pxr::HdSceneDelegate* delegate, pxr::SdfPath const& id) :
-    pxr::HdInstancer(delegate, id)
+    pxr::HdInstancer(delegate, id), _allChanged(true), _version(1)
 {
 }
 
 HdLighthouse2Instancer::~HdLighthouse2Instancer()
 {
-    TF_FOR_ALL(it, _primvarMap)
-    {
-        delete it->second;
-    }
-    _primvarMap.clear();
 }
 
 void HdLighthouse2Instancer::Sync(
@@ -26,10 +30,102 @@ void HdLighthouse2Instancer::Sync(
 {
     _UpdateInstancer(delegate, dirtyBits);
 
+    _changedIndices.clear();
+    _allChanged = (*dirtyBits & (pxr::HdChangeTracker::DirtyTransform |
+                                 pxr::HdChangeTracker::DirtyInstanceIndex |
+                                 pxr::HdChangeTracker::DirtyInstancer)) != 0;
+
     if (pxr::HdChangeTracker::IsAnyPrimvarDirty(*dirtyBits, GetId()))
     {
         _SyncPrimvars(delegate, *dirtyBits);
     }
+
+    // drops the cached transforms of this instancer and the nested ones
+    if (*dirtyBits & (pxr::HdChangeTracker::DirtyPrimvar |
+                      pxr::HdChangeTracker::DirtyTransform |
+                      pxr::HdChangeTracker::DirtyInstanceIndex |
+                      pxr::HdChangeTracker::DirtyInstancer))
+    {
+        _version++;
+        std::lock_guard<std::mutex> guard(_cacheMutex);
+        _transformCache.clear();
+    }
+}
+
+// vec4 rotations are stored real part first
+static pxr::GfQuatf _ToQuatf(pxr::GfVec4f const& v)
+{
+    return pxr::GfQuatf(v[0], v[1], v[2], v[3]);
+}
+
+static bool _GetVec3fArray(pxr::VtValue const& value, pxr::VtVec3fArray* o_array)
+{
+    if (value.IsHolding<pxr::VtVec3fArray>())
+    {
+        *o_array = value.UncheckedGet<pxr::VtVec3fArray>();
+        return true;
+    }
+    if (value.IsHolding<pxr::VtVec3dArray>())
+    {
+        auto const& values = value.UncheckedGet<pxr::VtVec3dArray>();
+        o_array->resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            (*o_array)[i] = pxr::GfVec3f(values[i]);
+        return true;
+    }
+    return false;
+}
+
+static bool _GetQuatfArray(pxr::VtValue const& value, pxr::VtQuatfArray* o_array)
+{
+    if (value.IsHolding<pxr::VtQuatfArray>())
+    {
+        *o_array = value.UncheckedGet<pxr::VtQuatfArray>();
+        return true;
+    }
+    if (value.IsHolding<pxr::VtQuathArray>())
+    {
+        auto const& values = value.UncheckedGet<pxr::VtQuathArray>();
+        o_array->resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            (*o_array)[i] = pxr::GfQuatf(values[i]);
+        return true;
+    }
+    if (value.IsHolding<pxr::VtVec4fArray>())
+    {
+        auto const& values = value.UncheckedGet<pxr::VtVec4fArray>();
+        o_array->resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            (*o_array)[i] = _ToQuatf(values[i]);
+        return true;
+    }
+    if (value.IsHolding<pxr::VtVec4hArray>())
+    {
+        auto const& values = value.UncheckedGet<pxr::VtVec4hArray>();
+        o_array->resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            (*o_array)[i] = _ToQuatf(pxr::GfVec4f(values[i]));
+        return true;
+    }
+    return false;
+}
+
+static bool _GetMatrix4fArray(pxr::VtValue const& value, pxr::VtMatrix4fArray* o_array)
+{
+    if (value.IsHolding<pxr::VtMatrix4dArray>())
+    {
+        auto const& values = value.UncheckedGet<pxr::VtMatrix4dArray>();
+        o_array->resize(values.size());
+        for (size_t i = 0; i < values.size(); ++i)
+            (*o_array)[i] = pxr::GfMatrix4f(values[i]);
+        return true;
+    }
+    if (value.IsHolding<pxr::VtMatrix4fArray>())
+    {
+        *o_array = value.UncheckedGet<pxr::VtMatrix4fArray>();
+        return true;
+    }
+    return false;
 }
 
 void HdLighthouse2Instancer::_SyncPrimvars(pxr::HdSceneDelegate* delegate, pxr::HdDirtyBits dirtyBits)
@@ -39,39 +135,179 @@ void HdLighthouse2Instancer::_SyncPrimvars(pxr::HdSceneDelegate* delegate, pxr::
     pxr::HdPrimvarDescriptorVector primvars =
         delegate->GetPrimvarDescriptors(id, pxr::HdInterpolationInstance);
 
+    // the instance* names win over the short ones when both are authored
+    pxr::TfToken translationsName, rotationsName, scalesName, instanceTransformsName;
+    pxr::TfToken displayColorsName;
     for (pxr::HdPrimvarDescriptor const& pv : primvars)
     {
-        //if (pxr::HdChangeTracker::IsPrimvarDirty(dirtyBits, id, pv.name))
+        if (pv.name == pxr::HdInstancerTokens->instanceTranslations ||
+            (pv.name == pxr::HdInstancerTokens->translate && translationsName.IsEmpty()))
+            translationsName = pv.name;
+        else if (pv.name == pxr::HdInstancerTokens->instanceRotations ||
+            (pv.name == pxr::HdInstancerTokens->rotate && rotationsName.IsEmpty()))
+            rotationsName = pv.name;
+        else if (pv.name == pxr::HdInstancerTokens->instanceScales ||
+            (pv.name == pxr::HdInstancerTokens->scale && scalesName.IsEmpty()))
+            scalesName = pv.name;
+        else if (pv.name == pxr::HdInstancerTokens->instanceTransforms ||
+            (pv.name == pxr::HdInstancerTokens->instanceTransform && instanceTransformsName.IsEmpty()))
+            instanceTransformsName = pv.name;
+        // a constant or uniform displayColor is not per instance
+        else if (pv.name == pxr::HdTokens->displayColor && pv.interpolation == pxr::HdInterpolationInstance)
+            displayColorsName = pv.name;
+    }
+
+    // only fetch what changed, or what now comes from another primvar
+    auto needsUpdate = [&](pxr::TfToken const& name, pxr::TfToken const& currentName)
+    {
+        return name != currentName ||
+            (!name.IsEmpty() && pxr::HdChangeTracker::IsPrimvarDirty(dirtyBits, id, name));
+    };
+    auto fetch = [&](pxr::TfToken const& name, auto getArray, auto* o_array)
+    {
+        const auto previous = *o_array;
+        o_array->clear();
+        if (!name.IsEmpty())
         {
-            pxr::VtValue value = delegate->Get(id, pv.name);
-            if (!value.IsEmpty())
-            {
-                if (_primvarMap.count(pv.name) > 0)
-                {
-                    delete _primvarMap[pv.name];
-                }
-                _primvarMap[pv.name] = new pxr::HdVtBufferSource(pv.name, value);
-            }
+            pxr::VtValue value = delegate->Get(id, name);
+            if (!value.IsEmpty() && !getArray(value, o_array))
+                std::cout << "Instancer " << id << ": unsupported type for " << name << std::endl;
         }
+        _RecordChanges(previous, *o_array);
+    };
+
+    if (needsUpdate(translationsName, _translationsName))
+        fetch(translationsName, _GetVec3fArray, &_translations);
+    if (needsUpdate(rotationsName, _rotationsName))
+        fetch(rotationsName, _GetQuatfArray, &_rotations);
+    if (needsUpdate(scalesName, _scalesName))
+        fetch(scalesName, _GetVec3fArray, &_scales);
+    if (needsUpdate(instanceTransformsName, _instanceTransformsName))
+        fetch(instanceTransformsName, _GetMatrix4fArray, &_instanceTransforms);
+    if (needsUpdate(displayColorsName, _displayColorsName))
+        fetch(displayColorsName, _GetVec3fArray, &_displayColors);
+
+    _translationsName = translationsName;
+    _rotationsName = rotationsName;
+    _scalesName = scalesName;
+    _instanceTransformsName = instanceTransformsName;
+    _displayColorsName = displayColorsName;
+}
+
+template <typename T>
+void HdLighthouse2Instancer::_RecordChanges(pxr::VtArray<T> const& previous, pxr::VtArray<T> const& current)
+{
+    if (_allChanged || previous.cdata() == current.cdata())
+        return;
+    if (previous.size() != current.size())
+    {
+        // instances added or removed, indices no longer match
+        _allChanged = true;
+        return;
+    }
+
+    if (_changedIndices.size() < current.size())
+        _changedIndices.resize(current.size(), 0);
+    const T* before = previous.cdata();
+    const T* after = current.cdata();
+    for (size_t i = 0; i < current.size(); ++i)
+    {
+        if (std::memcmp(&before[i], &after[i], sizeof(T)) != 0)
+            _changedIndices[i] = 1;
     }
 }
 
-bool SampleBuffer(pxr::HdVtBufferSource const& buffer, int index, void* value, pxr::HdTupleType dataType)
+size_t HdLighthouse2Instancer::_GetTransformVersion() const
 {
-    if (buffer.GetNumElements() <= (size_t)index || buffer.GetTupleType() != dataType)
+    size_t version = _version.load();
+    if (!GetParentId().IsEmpty())
     {
-        return false;
+        HdInstancer* parentInstancer = GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
+        if (parentInstancer)
+        {
+            version = pxr::TfHash::Combine(version,
+                static_cast<HdLighthouse2Instancer*>(parentInstancer)->_GetTransformVersion());
+        }
     }
+    return version;
+}
 
-    size_t elemSize = pxr::HdDataSizeOfTupleType(dataType);
-    size_t offset = elemSize * index;
+pxr::VtMatrix4fArray HdLighthouse2Instancer::_ComputeInstanceTransforms(pxr::SdfPath const& prototypeId)
+{
+    // prototypes (and nested instancers) of this instancer share one sync,
+    // each of them only pays for its transforms once.
+    const size_t version = _GetTransformVersion();
+    {
+        std::lock_guard<std::mutex> guard(_cacheMutex);
+        auto found = _transformCache.find(prototypeId);
+        if (found != _transformCache.end() && found->second.version == version)
+        {
+            return found->second.transforms;
+        }
+    }
 
-    std::memcpy(value, static_cast<const uint8_t*>(buffer.GetData()) + offset, elemSize);
+    // computed outside the lock, two prototypes racing for the same entry
+    // compute the same result.
+    pxr::VtMatrix4fArray transforms = _ComposeInstanceTransforms(prototypeId);
 
-    return true;
+    std::lock_guard<std::mutex> guard(_cacheMutex);
+    _transformCache[prototypeId] = CachedTransforms{ version, transforms };
+    return transforms;
 }
 
-pxr::VtMatrix4dArray HdLighthouse2Instancer::ComputeInstanceTransforms(pxr::SdfPath const& prototypeId)
+pxr::GfMatrix4f HdLighthouse2Instancer::_ComposeInstance(size_t index, pxr::GfMatrix4f const& instancerTransform) const
+{
+    // rotation rows, same as GfMatrix4f::SetRotate
+    float m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    if (index < _rotations.size())
+    {
+        const float w = _rotations.cdata()[index].GetReal();
+        const pxr::GfVec3f& q = _rotations.cdata()[index].GetImaginary();
+        m[0][0] = 1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2]);
+        m[0][1] = 2.0f * (q[0] * q[1] + q[2] * w);
+        m[0][2] = 2.0f * (q[2] * q[0] - q[1] * w);
+        m[1][0] = 2.0f * (q[0] * q[1] - q[2] * w);
+        m[1][1] = 1.0f - 2.0f * (q[2] * q[2] + q[0] * q[0]);
+        m[1][2] = 2.0f * (q[1] * q[2] + q[0] * w);
+        m[2][0] = 2.0f * (q[2] * q[0] + q[1] * w);
+        m[2][1] = 2.0f * (q[1] * q[2] - q[0] * w);
+        m[2][2] = 1.0f - 2.0f * (q[1] * q[1] + q[0] * q[0]);
+    }
+    if (index < _scales.size())
+    {
+        const pxr::GfVec3f& s = _scales.cdata()[index];
+        for (int c = 0; c < 3; ++c)
+        {
+            m[0][c] *= s[0];
+            m[1][c] *= s[1];
+            m[2][c] *= s[2];
+        }
+    }
+    const pxr::GfVec3f t = index < _translations.size() ? _translations.cdata()[index] : pxr::GfVec3f(0.0f);
+
+    const pxr::GfMatrix4f srt(
+        m[0][0], m[0][1], m[0][2], 0.0f,
+        m[1][0], m[1][1], m[1][2], 0.0f,
+        m[2][0], m[2][1], m[2][2], 0.0f,
+        t[0], t[1], t[2], 1.0f);
+
+    return index < _instanceTransforms.size()
+        ? _instanceTransforms.cdata()[index] * srt * instancerTransform
+        : srt * instancerTransform;
+}
+
+Lighthouse2Utils::InstanceAttributes HdLighthouse2Instancer::_GetInstanceAttributes(size_t index) const
+{
+    Lighthouse2Utils::InstanceAttributes attributes;
+    if (index < _displayColors.size())
+    {
+        const pxr::GfVec3f& color = _displayColors.cdata()[index];
+        attributes.tint = make_float3(color[0], color[1], color[2]);
+    }
+    return attributes;
+}
+
+pxr::VtMatrix4fArray HdLighthouse2Instancer::_ComposeInstanceTransforms(pxr::SdfPath const& prototypeId)
 {
     // The transforms for this level of instancer are computed by:
     // foreach(index : indices) {
@@ -79,124 +315,167 @@ pxr::VtMatrix4dArray HdLighthouse2Instancer::ComputeInstanceTransforms(pxr::SdfP
     //     scale(index) * instanceTransform(index)
     // }
     // If any transform isn't provided, it's assumed to be the identity.
+    // (row vector convention: the product below is written the other way)
 
-    pxr::GfMatrix4d instancerTransform = GetDelegate()->GetInstancerTransform(GetId());
-    pxr::VtIntArray instanceIndices = GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+    const pxr::GfMatrix4f instancerTransform(GetDelegate()->GetInstancerTransform(GetId()));
+    const pxr::VtIntArray instanceIndices = GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
 
-    pxr::VtMatrix4dArray transforms(instanceIndices.size());
-    for (size_t i = 0; i < instanceIndices.size(); ++i)
-    {
-        transforms[i] = instancerTransform;
-    }
-    pxr::HdVtBufferSource* pBuffer = nullptr;
+    const int* indices = instanceIndices.cdata();
 
-    if (_primvarMap.count(pxr::HdInstancerTokens->instanceTranslations) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->instanceTranslations];
-    else if (_primvarMap.count(pxr::HdInstancerTokens->translate) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->translate];
-    if (pBuffer)
-    {
-        for (size_t i = 0; i < instanceIndices.size(); ++i)
+    pxr::VtMatrix4fArray transforms(instanceIndices.size());
+    pxr::GfMatrix4f* out = transforms.data();
+
+    // one pass, the scale-rotate-translate part is built in place
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, instanceIndices.size(), kInstanceGrainSize),
+        [&](const tbb::blocked_range<size_t>& r)
         {
-            pxr::GfVec3f translate;
-            if (SampleBuffer(*pBuffer, instanceIndices[i], &translate, { pxr::HdTypeFloatVec3, 1 }))
+            for (size_t i = r.begin(); i < r.end(); ++i)
             {
-                pxr::GfMatrix4d translateMat(1);
-                translateMat.SetTranslate(pxr::GfVec3d(translate));
-                transforms[i] = translateMat * transforms[i];
+                out[i] = _ComposeInstance((size_t)indices[i], instancerTransform);
             }
-        }
+        });
+
+    if (GetParentId().IsEmpty())
+    {
+        return transforms;
     }
 
-    if (_primvarMap.count(pxr::HdInstancerTokens->instanceRotations) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->instanceRotations];
-    else if (_primvarMap.count(pxr::HdInstancerTokens->rotate) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->rotate];
-    if (pBuffer)
+    HdInstancer* parentInstancer = GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
+    if (!parentInstancer)
     {
-        for (size_t i = 0; i < instanceIndices.size(); ++i)
+        return transforms;
+    }
+
+    // The transforms taking nesting into account are computed by:
+    // parentTransforms = parentInstancer->ComputeInstanceTransforms(GetId())
+    // foreach (parentXf : parentTransforms, xf : transforms) {
+    //     parentXf * xf
+    // }
+    const pxr::VtMatrix4fArray parentTransforms =
+        static_cast<HdLighthouse2Instancer*>(parentInstancer)->_ComputeInstanceTransforms(GetId());
+
+    const size_t numTransforms = transforms.size();
+    pxr::VtMatrix4fArray final(parentTransforms.size() * numTransforms);
+    const pxr::GfMatrix4f* local = transforms.cdata();
+    const pxr::GfMatrix4f* parent = parentTransforms.cdata();
+    pxr::GfMatrix4f* nested = final.data();
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, final.size(), kInstanceGrainSize),
+        [&](const tbb::blocked_range<size_t>& r)
         {
-            pxr::GfQuath quat;
-            if (SampleBuffer(*pBuffer, instanceIndices[i], &quat, { pxr::HdTypeHalfFloatVec4, 1 }))
+            for (size_t k = r.begin(); k < r.end(); ++k)
             {
-                pxr::GfMatrix4d rotateMat(1);
-                rotateMat.SetRotate(quat);
-                transforms[i] = rotateMat * transforms[i];
+                nested[k] = local[k % numTransforms] * parent[k / numTransforms];
             }
-            else
+        });
+    return final;
+}
+
+void HdLighthouse2Instancer::ComputeInstanceTransforms(
+    pxr::SdfPath const& prototypeId,
+    pxr::GfMatrix4f const& prototypeTransform,
+    std::vector<mat4>& o_transforms)
+{
+    const pxr::VtMatrix4fArray transforms = _ComputeInstanceTransforms(prototypeId);
+    const pxr::GfMatrix4f* instances = transforms.cdata();
+
+    // lighthouse2 matrices are the transposed Hydra ones
+    o_transforms.resize(transforms.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, transforms.size(), kInstanceGrainSize),
+        [&](const tbb::blocked_range<size_t>& r)
+        {
+            for (size_t j = r.begin(); j < r.end(); ++j)
             {
-                pxr::GfVec4f quatf;
-                if (SampleBuffer(*pBuffer, instanceIndices[i], &quatf, { pxr::HdTypeFloatVec4, 1 }))
-                {
-                    pxr::GfMatrix4d rotateMat(1);
-                    rotateMat.SetRotate(pxr::GfQuatd(quatf[0], quatf[1], quatf[2], quatf[3]));
-                    transforms[i] = rotateMat * transforms[i];
-                }
+                const pxr::GfMatrix4f xform = (prototypeTransform * instances[j]).GetTranspose();
+                std::memcpy(o_transforms[j].cell, xform.data(), 16 * sizeof(float));
             }
-        }
+        });
+}
+
+bool HdLighthouse2Instancer::ComputeChangedInstanceTransforms(
+    pxr::SdfPath const& prototypeId,
+    pxr::GfMatrix4f const& prototypeTransform,
+    std::vector<int>& o_positions,
+    std::vector<mat4>& o_transforms,
+    std::vector<Lighthouse2Utils::InstanceAttributes>& o_attributes)
+{
+    // nested instances also move with their parents, those are recomputed
+    if (_allChanged || !GetParentId().IsEmpty())
+    {
+        return false;
     }
 
-    if (_primvarMap.count(pxr::HdInstancerTokens->instanceScales) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->instanceScales];
-    else if (_primvarMap.count(pxr::HdInstancerTokens->scale) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->scale];
-    if (pBuffer)
+    o_positions.clear();
+    o_transforms.clear();
+    o_attributes.clear();
+    if (_changedIndices.empty())
     {
-        for (size_t i = 0; i < instanceIndices.size(); ++i)
-        {
-            pxr::GfVec3f scale;
-            if (SampleBuffer(*pBuffer, instanceIndices[i], &scale, { pxr::HdTypeFloatVec3, 1 }))
-            {
-                pxr::GfMatrix4d scaleMat(1);
-                scaleMat.SetScale(pxr::GfVec3d(scale));
-                transforms[i] = scaleMat * transforms[i];
-            }
-        }
+        return true;
     }
 
-    if (_primvarMap.count(pxr::HdInstancerTokens->instanceTransforms) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->instanceTransforms];
-    else if (_primvarMap.count(pxr::HdInstancerTokens->instanceTransform) > 0)
-        pBuffer = _primvarMap[pxr::HdInstancerTokens->instanceTransform];
-    if (pBuffer)
+    const pxr::VtIntArray instanceIndices = GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+    const int* indices = instanceIndices.cdata();
+    for (size_t j = 0; j < instanceIndices.size(); ++j)
     {
-        for (size_t i = 0; i < instanceIndices.size(); ++i)
+        const size_t index = (size_t)indices[j];
+        if (index < _changedIndices.size() && _changedIndices[index])
+            o_positions.push_back((int)j);
+    }
+
+    const pxr::GfMatrix4f instancerTransform(GetDelegate()->GetInstancerTransform(GetId()));
+    o_transforms.resize(o_positions.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, o_positions.size(), kInstanceGrainSize),
+        [&](const tbb::blocked_range<size_t>& r)
         {
-            pxr::GfMatrix4d instanceTransform;
-            if (SampleBuffer(
-                *pBuffer, instanceIndices[i], &instanceTransform, { pxr::HdTypeDoubleMat4, 1 }))
+            for (size_t k = r.begin(); k < r.end(); ++k)
             {
-                transforms[i] = instanceTransform * transforms[i];
+                const size_t index = (size_t)indices[o_positions[k]];
+                const pxr::GfMatrix4f xform =
+                    (prototypeTransform * _ComposeInstance(index, instancerTransform)).GetTranspose();
+                std::memcpy(o_transforms[k].cell, xform.data(), 16 * sizeof(float));
             }
-        }
-    }
+        });
 
-    if (GetParentId().IsEmpty())
+    if (_HasInstanceAttributes())
     {
-        return transforms;
+        o_attributes.resize(o_positions.size());
+        for (size_t k = 0; k < o_positions.size(); ++k)
+            o_attributes[k] = _GetInstanceAttributes((size_t)indices[o_positions[k]]);
     }
+    return true;
+}
 
-    HdInstancer* parentInstancer = GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
-    if (!parentInstancer)
+void HdLighthouse2Instancer::ComputeInstanceAttributes(
+    pxr::SdfPath const& prototypeId,
+    std::vector<Lighthouse2Utils::InstanceAttributes>& o_attributes)
+{
+    o_attributes.clear();
+    if (!_HasInstanceAttributes())
     {
-        return transforms;
+        return;
     }
 
-    // The transforms taking nesting into account are computed by:
-    // parentTransforms = parentInstancer->ComputeInstanceTransforms(GetId())
-    // foreach (parentXf : parentTransforms, xf : transforms) {
-    //     parentXf * xf
-    // }
-    pxr::VtMatrix4dArray parentTransforms =
-        static_cast<HdLighthouse2Instancer*>(parentInstancer)->ComputeInstanceTransforms(GetId());
+    const pxr::VtIntArray instanceIndices = GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+    const size_t numInstances = instanceIndices.size();
 
-    pxr::VtMatrix4dArray final(parentTransforms.size() * transforms.size());
-    for (size_t i = 0; i < parentTransforms.size(); ++i)
+    // nested instances repeat this level once per parent instance, as the
+    // transforms do
+    size_t numParents = 1;
+    if (!GetParentId().IsEmpty())
     {
-        for (size_t j = 0; j < transforms.size(); ++j)
+        HdInstancer* parentInstancer = GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
+        if (parentInstancer)
         {
-            final[i * transforms.size() + j] = transforms[j] * parentTransforms[i];
+            numParents = static_cast<HdLighthouse2Instancer*>(parentInstancer)->_ComputeInstanceTransforms(GetId()).size();
         }
     }
-    return final;
-}
\ No newline at end of file
+
+    o_attributes.resize(numParents * numInstances);
+    for (size_t i = 0; i < numInstances; ++i)
+    {
+        o_attributes[i] = _GetInstanceAttributes((size_t)instanceIndices.cdata()[i]);
+    }
+    for (size_t p = 1; p < numParents; ++p)
+    {
+        std::copy(o_attributes.begin(), o_attributes.begin() + numInstances, o_attributes.begin() + p * numInstances);
+    }
+}
@@ -12,9 +12,18 @@
 #include <pxr/base/gf/vec2f.h>
 #include <pxr/base/gf/vec3f.h>
 #include <pxr/base/gf/vec4f.h>
+#include <pxr/base/gf/quatf.h>
 #include <pxr/base/gf/quaternion.h>
 #include <pxr/base/gf/rotation.h>
-#include <pxr/imaging/hd/vtBufferSource.h>
+#include <pxr/base/vt/types.h>
+
+#include "platform.h"
+#include "Lighthouse2Utils.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 class HdLighthouse2Instancer : public pxr::HdInstancer
 {
@@ -24,12 +33,77 @@ public:
 
     void Sync(pxr::HdSceneDelegate* sceneDelegate, pxr::HdRenderParam* renderParam, pxr::HdDirtyBits* dirtyBits) override;
 
-    pxr::VtMatrix4dArray ComputeInstanceTransforms(pxr::SdfPath const& prototypeId);
+    // Instance transforms of prototypeId, nested instancers included, each
+    // applied on top of prototypeTransform and written as lighthouse2 matrices.
+    void ComputeInstanceTransforms(
+        pxr::SdfPath const& prototypeId,
+        pxr::GfMatrix4f const& prototypeTransform,
+        std::vector<mat4>& o_transforms);
+
+    // Same as above for the instances moved by the last sync only, with
+    // their position in the ComputeInstanceTransforms output. Returns false
+    // if the change can't be narrowed down and everything must be recomputed.
+    bool ComputeChangedInstanceTransforms(
+        pxr::SdfPath const& prototypeId,
+        pxr::GfMatrix4f const& prototypeTransform,
+        std::vector<int>& o_positions,
+        std::vector<mat4>& o_transforms,
+        std::vector<Lighthouse2Utils::InstanceAttributes>& o_attributes);
+
+    // Per-instance displayColor of prototypeId, in ComputeInstanceTransforms
+    // order. Nested instances use the innermost values. Empty if it is not
+    // authored.
+    void ComputeInstanceAttributes(
+        pxr::SdfPath const& prototypeId,
+        std::vector<Lighthouse2Utils::InstanceAttributes>& o_attributes);
 
 private:
     void _SyncPrimvars(pxr::HdSceneDelegate* delegate, pxr::HdDirtyBits dirtyBits);
 
-    pxr::TfHashMap<pxr::TfToken, pxr::HdVtBufferSource*, pxr::TfToken::HashFunctor> _primvarMap;
+    // flag the primvar indices whose value differs after a fetch
+    template <typename T>
+    void _RecordChanges(pxr::VtArray<T> const& previous, pxr::VtArray<T> const& current);
+
+    // transform of a single instance of this level, Hydra convention
+    pxr::GfMatrix4f _ComposeInstance(size_t index, pxr::GfMatrix4f const& instancerTransform) const;
+    Lighthouse2Utils::InstanceAttributes _GetInstanceAttributes(size_t index) const;
+    bool _HasInstanceAttributes() const { return !_displayColors.empty(); }
+
+    // instancer and parents transforms, Hydra (row vector) convention.
+    // Cached per prototype until this instancer or a parent changes.
+    pxr::VtMatrix4fArray _ComputeInstanceTransforms(pxr::SdfPath const& prototypeId);
+    pxr::VtMatrix4fArray _ComposeInstanceTransforms(pxr::SdfPath const& prototypeId);
+
+    // changes with every sync that can move an instance, here or in a parent
+    size_t _GetTransformVersion() const;
+
+    // instance primvars, converted to a single type each when synced so
+    // the transform kernel reads them directly. Empty if not authored.
+    pxr::VtVec3fArray _translations;
+    pxr::VtQuatfArray _rotations;
+    pxr::VtVec3fArray _scales;
+    pxr::VtMatrix4fArray _instanceTransforms;
+    // per-instance shading attributes
+    pxr::VtVec3fArray _displayColors;
+    // primvar each of the arrays above was read from
+    pxr::TfToken _translationsName;
+    pxr::TfToken _rotationsName;
+    pxr::TfToken _scalesName;
+    pxr::TfToken _instanceTransformsName;
+    pxr::TfToken _displayColorsName;
+
+    // changes of the last sync: 1 per moved primvar index, or _allChanged
+    // if every instance has to be recomputed (count, indices, transform).
+    std::vector<uint8_t> _changedIndices;
+    bool _allChanged;
+
+    struct CachedTransforms {
+        size_t version;
+        pxr::VtMatrix4fArray transforms;
+    };
+    std::atomic<size_t> _version;
+    std::mutex _cacheMutex;
+    std::unordered_map<pxr::SdfPath, CachedTransforms, pxr::SdfPath::Hash> _transformCache;
 };
 
 #endif
\ No newline at end of file
@@ -18,6 +18,37 @@ TF_MAKE_STATIC_DATA(NdrTokenVec, _sourceTypes) {
     };
 }
 
+namespace {
+
+// Material converted by Sync into a detached HostMaterial, copied into the
+// scene material by UpdateScene. Textures are created there as they add to
+// the scene texture list.
+struct HdLighthouse2MaterialUpdate final : public HdLighthouse2RenderDelegate::SceneUpdate
+{
+    HdLighthouse2Handle handle;
+    HostMaterial material;
+    HdLighthouse2Material::PendingTextures textures;
+
+    virtual void Apply(HdLighthouse2RenderDelegate& i_delegate) override
+    {
+        HostScene* ltScene = i_delegate.GetRenderer()->GetScene();
+        for (auto& texture : textures)
+        {
+            *texture.textureID = ltScene->FindOrCreateTexture(texture.filename, texture.modFlags);
+            ltScene->textures[*texture.textureID]->ConstructMIPmaps();
+        }
+
+        // keep the scene material (and its ID), meshes refer to it
+        auto& ltMat = i_delegate.GetMaterial(handle);
+        const int materialID = ltMat.material->ID;
+        *ltMat.material = material;
+        ltMat.material->ID = materialID;
+        ltMat.material->MarkAsDirty();
+    }
+};
+
+} // anonymous namespace
+
 static float luminance(const pxr::GfVec3f& value)
 {
     static constexpr pxr::GfVec3f kLuminanceFactors = pxr::GfVec3f(0.2125f, 0.7154f, 0.0721f);
@@ -28,9 +59,15 @@ static float luminance(const pxr::GfVec3f& value)
 HdLighthouse2Material::HdLighthouse2Material(SdfPath const& id, HdLighthouse2RenderDelegate* renderDelegate) :
     HdMaterial(id), _owner(renderDelegate)
 {
+    // meshes bound to this path share the same material
+    std::lock_guard<std::mutex> guard(_owner->rendererMutex());
+    _handle = _owner->GetMaterialHandle(id);
 }
 
-HdLighthouse2Material::~HdLighthouse2Material() {}
+HdLighthouse2Material::~HdLighthouse2Material()
+{
+    _owner->DestroyMaterial(_handle);
+}
 
 HdDirtyBits HdLighthouse2Material::GetInitialDirtyBitsMask() const
 {
@@ -45,16 +82,21 @@ void HdLighthouse2Material::Sync(HdSceneDelegate* delegate, HdRenderParam* rende
     if ((*dirtyBits & HdMaterial::DirtyResource) || (*dirtyBits & HdMaterial::DirtyParams))
     {
         //std::cout << "Updated material " << id << std::endl;
-        std::lock_guard<std::mutex> guard(_owner->rendererMutex());
-        auto& ltMat = _owner->GetMaterial(id, make_float3(1,1,1) );
-        auto* ltScene = _owner->GetRenderer()->GetScene();
+
+        // converted without any lock, from the delegate defaults, and
+        // handed over to UpdateScene.
+        std::unique_ptr<HdLighthouse2MaterialUpdate> update(new HdLighthouse2MaterialUpdate());
+        update->handle = _handle;
+        HdLighthouse2RenderDelegate::InitMaterial(&update->material, make_float3(1, 1, 1));
 
         VtValue materialValue = delegate->GetMaterialResource(id);
         if (materialValue.IsHolding<pxr::HdMaterialNetworkMap>())
         {
             auto network2Map = HdConvertToHdMaterialNetwork2(materialValue.UncheckedGet<HdMaterialNetworkMap>());
-            HdMaterialToLighthouse2Material(ltScene, ltMat.material, network2Map, id);
+            HdMaterialToLighthouse2Material(&update->textures, &update->material, network2Map, id);
         }
+
+        _owner->EnqueueSceneUpdate(std::move(update));
     }
 
     *dirtyBits &= ~HdChangeTracker::AllDirty;
@@ -65,7 +107,7 @@ void HdLighthouse2Material::Finalize(HdRenderParam* renderParam) {
 }
 
 template <>
-void HdLighthouse2Material::LtSetParam<HostMaterial::Vec3Value>(HostScene* ltScene, HostMaterial::Vec3Value& ltParam, const VtValue& vtVal)
+void HdLighthouse2Material::LtSetParam<HostMaterial::Vec3Value>(PendingTextures* ltTextures, HostMaterial::Vec3Value& ltParam, const VtValue& vtVal)
 {
     if (vtVal.IsHolding<GfVec3f>())
     {
@@ -90,8 +132,7 @@ void HdLighthouse2Material::LtSetParam<HostMaterial::Vec3Value>(HostScene* ltSce
         texFile.open(filename);
         if (texFile)
         {
-            ltParam.textureID = ltScene->FindOrCreateTexture(filename, modFlags);
-            ltScene->textures[ltParam.textureID]->ConstructMIPmaps();
+            ltTextures->push_back({ &ltParam.textureID, filename, (uint)modFlags });
         }
         else
         {
@@ -102,7 +143,7 @@ void HdLighthouse2Material::LtSetParam<HostMaterial::Vec3Value>(HostScene* ltSce
 }
 
 template<>
-void HdLighthouse2Material::LtSetParam<HostMaterial::ScalarValue>(HostScene* ltScene, HostMaterial::ScalarValue& ltParam, const VtValue& vtVal)
+void HdLighthouse2Material::LtSetParam<HostMaterial::ScalarValue>(PendingTextures* ltTextures, HostMaterial::ScalarValue& ltParam, const VtValue& vtVal)
 {
     if (vtVal.IsHolding<GfVec3f>())
     {
@@ -127,19 +168,17 @@ void HdLighthouse2Material::LtSetParam<HostMaterial::ScalarValue>(HostScene* ltS
         texFile.open(filename);
         if (texFile)
         {
-            ltParam.textureID = ltScene->FindOrCreateTexture(filename, modFlags);
-            ltScene->textures[ltParam.textureID]->ConstructMIPmaps();
+            ltTextures->push_back({ &ltParam.textureID, filename, (uint)modFlags });
         }
         else
         {
             ltParam = 0.0;
         }
-        //std::cout << "MIPMAP " << ltScene->textures[ltParam.textureID]->MIPlevels << std::endl;
     }
 }
 
 template<>
-void HdLighthouse2Material::LtSetParam<float>(HostScene* ltScene, float& ltParam, const VtValue& vtVal)
+void HdLighthouse2Material::LtSetParam<float>(PendingTextures* ltTextures, float& ltParam, const VtValue& vtVal)
 {
     if (vtVal.IsHolding<float>())
     {
@@ -156,60 +195,62 @@ HdLighthouse2Material::GetShaderSourceTypes()
 }
 
 void HdLighthouse2Material::HdParamToLtParam(
-    lighthouse2::HostScene* i_scene,
+    PendingTextures* i_textures,
     lighthouse2::HostMaterial* i_mat,
     const TfToken& i_parmName,
     const VtValue& i_value)
 {
     if (i_parmName == TfToken("base_color") || i_parmName == TfToken("diffuseColor"))
-        LtSetParam(i_scene, i_mat->color, i_value);
+        LtSetParam(i_textures, i_mat->color, i_value);
     else if (i_parmName == TfToken("normal"))
-        LtSetParam(i_scene, i_mat->detailNormals, i_value);
+        LtSetParam(i_textures, i_mat->detailNormals, i_value);
     else if (i_parmName == TfToken("metalness") || i_parmName == TfToken("metallic"))
-        LtSetParam(i_scene, i_mat->metallic, i_value);
+        LtSetParam(i_textures, i_mat->metallic, i_value);
     else if (i_parmName == TfToken("specular_roughness") || i_parmName == TfToken("roughness"))
-        LtSetParam(i_scene, i_mat->roughness, i_value);
+        LtSetParam(i_textures, i_mat->roughness, i_value);
     else if (i_parmName == TfToken("ior"))
-        LtSetParam(i_scene, i_mat->ior, i_value);
+        LtSetParam(i_textures, i_mat->ior, i_value);
     else if (i_parmName == TfToken("clearcoat"))
-        LtSetParam(i_scene, i_mat->clearcoat, i_value);
+        LtSetParam(i_textures, i_mat->clearcoat, i_value);
     else if (i_parmName == TfToken("clearcoatRoughness"))
     {
+        // only a value can be inverted, a texture would be dropped with the local
         auto clearcoatRoughness = lighthouse2::HostMaterial::ScalarValue();
-        LtSetParam(i_scene, clearcoatRoughness, i_value);
+        if (!i_value.IsHolding<SdfAssetPath>())
+            LtSetParam(i_textures, clearcoatRoughness, i_value);
         i_mat->clearcoatGloss.value = 1.0 - clearcoatRoughness.value;
     }
     else if (i_parmName == TfToken("transmission"))
     {
-        LtSetParam(i_scene, i_mat->transmission.scale, i_value);
+        LtSetParam(i_textures, i_mat->transmission.scale, i_value);
         i_mat->eta = 0.5;
         i_mat->ior = 1.5;
     }
     else if (i_parmName == TfToken("transmission_color"))
     {
-        LtSetParam(i_scene, i_mat->transmission, i_value);
+        LtSetParam(i_textures, i_mat->transmission, i_value);
         i_mat->eta = 0.5;
         i_mat->ior = 1.5;
     }
     else if (i_parmName == TfToken("specular"))
-        LtSetParam(i_scene, i_mat->specular, i_value);
+        LtSetParam(i_textures, i_mat->specular, i_value);
     else if (i_parmName == TfToken("specular_color"))
-        LtSetParam(i_scene, i_mat->specularTint, i_value);
+        LtSetParam(i_textures, i_mat->specularTint, i_value);
     else if (i_parmName == TfToken("opacity"))
-        LtSetParam(i_scene, i_mat->opacity, i_value);
+        LtSetParam(i_textures, i_mat->opacity, i_value);
     else if (i_parmName == TfToken("subsurface"))
-        LtSetParam(i_scene, i_mat->subsurface, i_value);
+        LtSetParam(i_textures, i_mat->subsurface, i_value);
     else if (i_parmName == TfToken("subsurface_scale"))
-        LtSetParam(i_scene, i_mat->subsurface.scale, i_value);
+        LtSetParam(i_textures, i_mat->subsurface.scale, i_value);
     else
         std::cout << "Param " << i_parmName << " (" << TfStringify(i_value) << ") unrecognized" << std::endl;
 }
 
-void HdLighthouse2Material::FindConnectedParameters(lighthouse2::HostScene* ltScene, lighthouse2::HostMaterial* ltMat, const TfToken& conn, HdMaterialNetwork2 const& network, const SdfPath& i_name, const HdMaterialNode2& i_node)
+void HdLighthouse2Material::FindConnectedParameters(PendingTextures* ltTextures, lighthouse2::HostMaterial* ltMat, const TfToken& conn, HdMaterialNetwork2 const& network, const SdfPath& i_name, const HdMaterialNode2& i_node)
 {
     // search for parameters
     for (auto const& paramEntry : i_node.parameters)
-        HdParamToLtParam(ltScene, ltMat, conn, paramEntry.second);
+        HdParamToLtParam(ltTextures, ltMat, conn, paramEntry.second);
 
     // check for more parameters in connected nodes
     for (auto const& connEntry : i_node.inputConnections)
@@ -217,12 +258,12 @@ void HdLighthouse2Material::FindConnectedParameters(lighthouse2::HostScene* ltSc
         for (auto const& e : connEntry.second)
         {
             const HdMaterialNode2* upstreamNode = TfMapLookupPtr(network.nodes, e.upstreamNode);
-            FindConnectedParameters(ltScene, ltMat, conn, network, e.upstreamNode, *upstreamNode);
+            FindConnectedParameters(ltTextures, ltMat, conn, network, e.upstreamNode, *upstreamNode);
         }
     }
 }
 
-void HdLighthouse2Material::HdMaterialToLighthouse2Material(lighthouse2::HostScene* ltScene, lighthouse2::HostMaterial* ltMat, HdMaterialNetwork2 const& network, SdfPath const& id)
+void HdLighthouse2Material::HdMaterialToLighthouse2Material(PendingTextures* ltTextures, lighthouse2::HostMaterial* ltMat, HdMaterialNetwork2 const& network, SdfPath const& id)
 {
     for (auto const& terminalEntry : network.terminals)
     {
@@ -232,7 +273,7 @@ void HdLighthouse2Material::HdMaterialToLighthouse2Material(lighthouse2::HostSce
 
             // search for parameters
             for (auto const& paramEntry : upstreamNode->parameters)
-                HdParamToLtParam(ltScene, ltMat, paramEntry.first, paramEntry.second);
+                HdParamToLtParam(ltTextures, ltMat, paramEntry.first, paramEntry.second);
 
             // check for more parameters in connected nodes
             for (auto const& connEntry : upstreamNode->inputConnections)
@@ -240,7 +281,7 @@ void HdLighthouse2Material::HdMaterialToLighthouse2Material(lighthouse2::HostSce
                 for (auto const& e : connEntry.second)
                 {
                     const HdMaterialNode2* otherNode = TfMapLookupPtr(network.nodes, e.upstreamNode);
-                    FindConnectedParameters(ltScene, ltMat, connEntry.first, network, e.upstreamNode, *otherNode);
+                    FindConnectedParameters(ltTextures, ltMat, connEntry.first, network, e.upstreamNode, *otherNode);
                 }
             }
         }
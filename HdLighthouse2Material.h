@@ -4,6 +4,7 @@
 #include <pxr/pxr.h>
 #include <pxr/imaging/hd/material.h>
 #include <string>
+#include <vector>
 
 #include "HdLighthouse2RenderDelegate.h"
 
@@ -19,24 +20,33 @@ public:
     virtual void Sync(HdSceneDelegate* delegate, HdRenderParam* renderParam, HdDirtyBits* dirtyBits) override;
 
     virtual void Finalize(HdRenderParam* renderParam) override;
+
+    // texture bound to a parameter of a staged material, only created in
+    // the scene when the delegate applies the material update.
+    struct PendingTexture {
+        int* textureID;
+        std::string filename;
+        uint modFlags;
+    };
+    using PendingTextures = std::vector<PendingTexture>;
     
     template <typename T>
-    void LtSetParam(HostScene* ltScene, T& ltParam, const VtValue& vtVal);
+    void LtSetParam(PendingTextures* ltTextures, T& ltParam, const VtValue& vtVal);
     template <>
-    void LtSetParam<HostMaterial::Vec3Value>(HostScene* ltScene, HostMaterial::Vec3Value& ltParam, const VtValue& vtVal);
+    void LtSetParam<HostMaterial::Vec3Value>(PendingTextures* ltTextures, HostMaterial::Vec3Value& ltParam, const VtValue& vtVal);
     template <>
-    void LtSetParam<HostMaterial::ScalarValue>(HostScene* ltScene, HostMaterial::ScalarValue& ltParam, const VtValue& vtVal);
+    void LtSetParam<HostMaterial::ScalarValue>(PendingTextures* ltTextures, HostMaterial::ScalarValue& ltParam, const VtValue& vtVal);
     template <>
-    void LtSetParam<float>(HostScene* ltScene, float& ltParam, const VtValue& vtVal);
+    void LtSetParam<float>(PendingTextures* ltTextures, float& ltParam, const VtValue& vtVal);
 
     void HdParamToLtParam(
-        lighthouse2::HostScene* i_scene,
+        PendingTextures* i_textures,
         lighthouse2::HostMaterial* i_mat,
         const TfToken& i_parmName,
         const VtValue& i_value);
 
     void FindConnectedParameters(
-        lighthouse2::HostScene* ltScene,
+        PendingTextures* ltTextures,
         lighthouse2::HostMaterial* ltMat,
         const TfToken& conn,
         HdMaterialNetwork2 const& network,
@@ -44,7 +54,7 @@ public:
         const HdMaterialNode2& i_node);
 
     void HdMaterialToLighthouse2Material(
-        lighthouse2::HostScene* ltScene,
+        PendingTextures* ltTextures,
         lighthouse2::HostMaterial* ltMat,
         HdMaterialNetwork2 const& network,
         SdfPath const& id);
@@ -55,6 +65,7 @@ public:
 
 private:
     HdLighthouse2RenderDelegate* _owner;
+    HdLighthouse2Handle _handle;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
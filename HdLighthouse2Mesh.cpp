@@ -1,6 +1,7 @@
 #include "HdLighthouse2Mesh.h"
 #include "HdLighthouse2RenderPass.h"
 #include "HdLighthouse2Instancer.h"
+#include "Lighthouse2Utils.h"
 #include <pxr/imaging/hd/extComputationUtils.h>
 #include <pxr/imaging/hd/material.h>
 #include <pxr/imaging/hd/vertexAdjacency.h>
@@ -10,15 +11,135 @@
 #include <pxr/base/gf/matrix4f.h>
 #include <pxr/base/gf/matrix4d.h>
 #include <pxr/base/gf/vec2f.h>
+#include <pxr/base/gf/range3f.h>
 #include <pxr/usd/usdUtils/pipeline.h>
+#include <pxr/base/arch/hash.h>
+#include <pxr/base/tf/hash.h>
 
 #include <algorithm> // sort
+#include <cstring> // memcpy
 
 PXR_NAMESPACE_OPEN_SCOPE
 
+namespace {
+
+// Mesh data converted by Sync, moved into the delegate mesh by UpdateScene.
+struct HdLighthouse2MeshUpdate final : public HdLighthouse2RenderDelegate::SceneUpdate
+{
+    HdLighthouse2Handle handle;
+
+    bool hasGeometry = false;
+    bool hasTopology = false; // uvs/st staged, triangles must be rebuilt
+    std::vector<int> indices;
+    std::vector<float3> vertices;
+    std::vector<float3> normals;
+    std::vector<float2> uvs;
+    std::vector<float2> st;
+    size_t geometryHash = 0;
+    float3 boundsCenter = make_float3(0, 0, 0);
+    float boundsRadius = 0.0f;
+
+    bool hasMaterial = false; // (re)bind to materialId
+    SdfPath materialId;
+    float3 displayColor = make_float3(1, 1, 1);
+
+    bool hasTransforms = false;
+    bool instanced = false;
+    std::vector<mat4> transforms;
+    std::vector<Lighthouse2Utils::InstanceAttributes> attributes;
+
+    // only some instances moved, by index in the prototype transforms
+    bool hasChangedTransforms = false;
+    std::vector<int> changedInstances;
+    std::vector<mat4> changedTransforms;
+    std::vector<Lighthouse2Utils::InstanceAttributes> changedAttributes; // empty if none authored
+
+    virtual void Apply(HdLighthouse2RenderDelegate& i_delegate) override
+    {
+        auto& mesh = i_delegate.GetMesh(handle);
+        if (hasMaterial)
+        {
+            // take the new reference before dropping the old one, they
+            // may be the same material
+            const HdLighthouse2Handle previous = mesh.material;
+            mesh.material = i_delegate.GetMaterialHandle(materialId, displayColor);
+            i_delegate.ReleaseMaterialHandle(previous);
+            // the triangles store the material ID, a refit would keep the
+            // released one
+            if (mesh.material != previous)
+                mesh.dirtyTopology = true;
+        }
+        if (hasGeometry)
+        {
+            mesh.indices.swap(indices);
+            mesh.vertices.swap(vertices);
+            mesh.normals.swap(normals);
+            if (hasTopology)
+            {
+                mesh.uvs.swap(uvs);
+                mesh.st.swap(st);
+                mesh.dirtyTopology = true;
+            }
+            mesh.geometryHash = geometryHash;
+            mesh.boundsCenter = boundsCenter;
+            mesh.boundsRadius = boundsRadius;
+            mesh.dirtyMesh = true;
+        }
+        if (hasTransforms)
+        {
+            mesh.newTransforms.swap(transforms);
+            mesh.attributes.swap(attributes);
+            mesh.instanced = instanced;
+            mesh.dirtyTransform = true;
+            // superseded by the full set
+            mesh.changedInstances.clear();
+            mesh.changedTransforms.clear();
+            mesh.changedSlots.clear();
+        }
+        else if (hasChangedTransforms)
+        {
+            // attributes always match the latest transforms, patched right away
+            for (size_t k = 0; k < changedAttributes.size(); ++k)
+            {
+                if ((size_t)changedInstances[k] < mesh.attributes.size())
+                    mesh.attributes[changedInstances[k]] = changedAttributes[k];
+            }
+            if (mesh.dirtyTransform)
+            {
+                // the full set is not diffed yet, patch it instead
+                for (size_t k = 0; k < changedInstances.size(); ++k)
+                {
+                    if ((size_t)changedInstances[k] < mesh.newTransforms.size())
+                        mesh.newTransforms[changedInstances[k]] = changedTransforms[k];
+                }
+            }
+            else
+            {
+                for (size_t k = 0; k < changedInstances.size(); ++k)
+                {
+                    auto slot = mesh.changedSlots.emplace(changedInstances[k], mesh.changedInstances.size());
+                    if (slot.second)
+                    {
+                        mesh.changedInstances.push_back(changedInstances[k]);
+                        mesh.changedTransforms.push_back(changedTransforms[k]);
+                    }
+                    else
+                    {
+                        mesh.changedTransforms[slot.first->second] = changedTransforms[k];
+                    }
+                }
+            }
+        }
+        i_delegate.MarkMeshDirty(handle, mesh);
+    }
+};
+
+} // anonymous namespace
+
 HdLighthouse2Mesh::HdLighthouse2Mesh(SdfPath const& id, HdLighthouse2RenderDelegate* delegate)
     : HdMesh(id)
-    , _adjacencyValid(false)
+    , _topologyHash(0)
+    , _primvarsValid(false)
     , _normalsValid(false)
     , _refined(false)
     , _smoothNormals(false)
@@ -26,12 +147,13 @@ HdLighthouse2Mesh::HdLighthouse2Mesh(SdfPath const& id, HdLighthouse2RenderDeleg
     , _cullStyle(HdCullStyleDontCare)
     , _owner(delegate)
 {
+    std::lock_guard<std::mutex> guard(_owner->rendererMutex());
+    _handle = _owner->CreateMesh();
 }
 
 HdLighthouse2Mesh::~HdLighthouse2Mesh()
 {
-    std::lock_guard<std::mutex> guard(_owner->rendererMutex());
-    //_owner->removeMesh(GetId());
+    _owner->DestroyMesh(_handle);
 }
 
 void
@@ -89,6 +211,10 @@ HdLighthouse2Mesh::_PopulateMesh(HdSceneDelegate* sceneDelegate,
     SdfPath const& id = GetId();
     //std::cout << "Syncing " << id << std::endl;
 
+    // everything below is converted without any lock, the delegate picks
+    // it up in UpdateScene.
+    std::unique_ptr<HdLighthouse2MeshUpdate> update;
+
     // Synchronize instancer.
     _UpdateInstancer(sceneDelegate, dirtyBits);
     HdInstancer::_SyncInstancerAndParents(sceneDelegate->GetRenderIndex(), GetInstancerId());
@@ -105,7 +231,8 @@ HdLighthouse2Mesh::_PopulateMesh(HdSceneDelegate* sceneDelegate,
         int refineLevel = _topology.GetRefineLevel();
         _topology = HdMeshTopology(GetMeshTopology(sceneDelegate), refineLevel);
         _topology.SetSubdivTags(subdivTags);
-        _adjacencyValid = false;
+        // cached uvs/st were sized and laid out for the old topology
+        _primvarsValid = false;
     }
     if (HdChangeTracker::IsSubdivTagsDirty(*dirtyBits, id) &&
         _topology.GetRefineLevel() > 0) {
@@ -131,6 +258,7 @@ HdLighthouse2Mesh::_PopulateMesh(HdSceneDelegate* sceneDelegate,
         HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->widths) ||
         HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->primvar)) {
         //_UpdatePrimvarSources(sceneDelegate, *dirtyBits);
+        _primvarsValid = false;
     }
 
     bool _materialChanged = false;
@@ -187,88 +315,111 @@ HdLighthouse2Mesh::_PopulateMesh(HdSceneDelegate* sceneDelegate,
 
  
     // Populate points in the RTC mesh.
-    if (newMesh || HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points)) 
+    if (newMesh || !_primvarsValid || _materialChanged || HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points)) 
     {
+        // triangulation and adjacency are only rebuilt on real topology
+        // changes, a points-only update reuses them.
+        const bool topologyChanged = _UpdateTopologyCache();
+        const bool primvarsChanged = !_primvarsValid;
+        // a new material needs the triangles rebuilt, so the uvs staged too
+        const bool rebuildTriangles = primvarsChanged || topologyChanged || _materialChanged;
 
-        std::lock_guard<std::mutex> guard(_owner->rendererMutex());
-        auto& mesh = _owner->GetMesh(id);
-
-        // check for uv(for vertex-varying) or st(for facevarying)
-        VtArray<GfVec2f> st;
-        VtArray<GfVec2f> uvs;
-
-        _topology = sceneDelegate->GetMeshTopology(id);
-        HdMeshUtil meshUtil(&_topology, id);
-        VtIntArray trianglePrimitiveParams;
-        meshUtil.ComputeTriangleIndices(&_triangulatedIndices, &trianglePrimitiveParams);
+        update.reset(new HdLighthouse2MeshUpdate());
+        update->handle = _handle;
+        update->hasGeometry = true;
 
         // check for primvars of interest
+        // uv(for vertex-varying) or st(for facevarying)
         // 
-        std::vector<HdInterpolation> primvarInterpolations = {
-            HdInterpolation::HdInterpolationVertex,
-            HdInterpolation::HdInterpolationFaceVarying,
-        };
-        for (auto& primvarInterpolation : primvarInterpolations)
+        if (!_primvarsValid)
         {
-            HdPrimvarDescriptorVector pvs = sceneDelegate->GetPrimvarDescriptors(id, primvarInterpolation);
-            for (auto& pv : pvs)
+            _uvs = VtVec2fArray();
+            _st = VtVec2fArray();
+            std::vector<HdInterpolation> primvarInterpolations = {
+                HdInterpolation::HdInterpolationVertex,
+                HdInterpolation::HdInterpolationFaceVarying,
+            };
+            for (auto& primvarInterpolation : primvarInterpolations)
             {
-                // Check for UV/STs
-                //
-                if (pv.name == UsdUtilsGetPrimaryUVSetName())
+                HdPrimvarDescriptorVector pvs = sceneDelegate->GetPrimvarDescriptors(id, primvarInterpolation);
+                for (auto& pv : pvs)
                 {
-                    if (primvarInterpolation == HdInterpolation::HdInterpolationVertex)
+                    // Check for UV/STs
+                    //
+                    if (pv.name == UsdUtilsGetPrimaryUVSetName())
                     {
-                        const VtValue& stVal = sceneDelegate->Get(id, pv.name);
-                        if (stVal.GetArraySize() == _points.size())
+                        const VtValue& stVal = GetPrimvar(sceneDelegate, pv.name);
+                        if (!stVal.IsHolding<VtVec2fArray>())
+                            continue;
+                        if (primvarInterpolation == HdInterpolation::HdInterpolationVertex)
                         {
-                            // valid vertex st
-                            uvs = stVal.Get<VtArray<GfVec2f>>();
+                            if (stVal.GetArraySize() == _points.size())
+                            {
+                                // valid vertex st
+                                _uvs = stVal.UncheckedGet<VtVec2fArray>();
+                            }
                         }
-                    }
-                    else
-                    {
-                        // Get primvar for STs
-                        VtValue stVal;
-                        auto tmpSt = GetPrimvar(sceneDelegate, pv.name);
-                        HdVtBufferSource buffer(pv.name, tmpSt);
-                        // Triangulate the STs (should produce an ST for each index)
-                        meshUtil.ComputeTriangulatedFaceVaryingPrimvar(
-                            buffer.GetData(), (int)buffer.GetNumElements(), buffer.GetTupleType().type, &stVal);
-                        st = stVal.Get<VtArray<GfVec2f>>();
-                        for (auto& c : st)
+                        else
                         {
-                            mesh.st.emplace_back(make_float2(c.data()[0], c.data()[1]));
+                            _st = stVal.UncheckedGet<VtVec2fArray>();
                         }
                     }
+                    // any other primvar ?
                 }
-                // any other primvar ?
             }
         }
 
-        // Make sure we have all triangles
-        mesh.indices.clear();
-
-        for (auto& t : _triangulatedIndices)
+        // uvs are only staged when the triangles have to be rebuilt,
+        // a refit keeps the ones already in the HostMesh.
+        if (rebuildTriangles)
         {
-            mesh.indices.emplace_back(t.data()[0]);
-            mesh.indices.emplace_back(t.data()[1]);
-            mesh.indices.emplace_back(t.data()[2]);
+            update->hasTopology = true;
+
+            // Triangulate the STs (should produce an ST for each index)
+            //
+            if (_st.size() > 0)
+            {
+                const VtVec3iArray& faceVaryingTriangulation = _sharedTopology->GetFaceVaryingTriangulation();
+                update->st.resize(faceVaryingTriangulation.size() * 3);
+                for (size_t ti = 0; ti < faceVaryingTriangulation.size(); ++ti)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        const int fvIdx = faceVaryingTriangulation[ti].data()[c];
+                        const GfVec2f st = (fvIdx >= 0 && fvIdx < (int)_st.size()) ? _st[fvIdx] : GfVec2f(0.0f);
+                        update->st[ti * 3 + c] = make_float2(st.data()[0], st.data()[1]);
+                    }
+                }
+            }
+
+            if (_uvs.size() > 0)
+            {
+                update->uvs.resize(_uvs.size());
+                for (size_t pi = 0; pi < _uvs.size(); ++pi)
+                {
+                    update->uvs[pi] = make_float2(_uvs[pi].data()[0], _uvs[pi].data()[1]);
+                }
+            }
         }
+        _primvarsValid = true;
 
-        // Get normals (smooth them for now)
-        //
-        //std::cout << "Building normals..." << std::endl;
-        Hd_VertexAdjacency _adjacency;
-        _adjacency.BuildAdjacencyTable(&_topology);
-        auto _computedNormals = Hd_SmoothNormals::ComputeSmoothNormals(&_adjacency, _points.size(), _points.cdata());
+        // Make sure we have all triangles
+        // (delegate staging is released after each upload, so always send them)
+        const VtVec3iArray& triangulatedIndices = _sharedTopology->triangulatedIndices;
+        static_assert(sizeof(GfVec3i) == 3 * sizeof(int), "GfVec3i must be tightly packed");
+        update->indices.resize(triangulatedIndices.size() * 3);
+        if (triangulatedIndices.size() > 0)
+        {
+            std::memcpy(update->indices.data(), triangulatedIndices.cdata(), triangulatedIndices.size() * sizeof(GfVec3i));
+        }
 
         // search for displayColor, but only use first value for now
         //
         //std::cout << "Building displayColors..." << std::endl;
         float3 displayColor = make_float3(1, 1, 1);
+        const bool hasMaterial = !matId.IsEmpty();
 
-        if (matId.IsEmpty())
+        if (!hasMaterial)
         {
             matId = id;
             VtValue colorValue = sceneDelegate->Get(id, HdTokens->displayColor);
@@ -281,71 +432,182 @@ HdLighthouse2Mesh::_PopulateMesh(HdSceneDelegate* sceneDelegate,
                     valueArray[0].data()[2]);
             }
         }
-        auto& mat = _owner->GetMaterial(matId, displayColor);
-        _owner->BindMeshToMaterial(id, matId);
+        // the path is only resolved to a material handle when the binding changes
+        update->hasMaterial = newMesh || _materialChanged;
+        update->materialId = matId;
+        update->displayColor = displayColor;
+
+        // content hash to share identical geometry between prims, a mesh
+        // that only gets new points is deforming and is never shared.
+        if (rebuildTriangles)
+        {
+            update->geometryHash = hasMaterial
+                ? _ComputeGeometryHash(TfHash()(matId))
+                : _ComputeGeometryHash(ArchHash64((const char*)&displayColor, sizeof(float3)));
+        }
 
-        for (int pi = 0; pi < _points.size();++pi)
+        // Get points and normals (smooth them for now)
+        //
+        update->vertices.resize(_points.size());
+        update->normals.resize(_points.size());
+        Lighthouse2Utils::CopyVec3f(_points.cdata(), _points.size(), update->vertices.data());
+        Lighthouse2Utils::ComputeSmoothNormals(_sharedTopology->adjacency, _points.size(), _points.cdata(), update->normals.data());
+        _normalsValid = true;
+
+        // bounding sphere, for instance culling
+        if (_points.size() > 0)
         {
-            mesh.vertices.emplace_back(make_float3(_points[pi].data()[0], _points[pi].data()[1], _points[pi].data()[2]));
-            mesh.normals.emplace_back(make_float3(_computedNormals[pi].data()[0], _computedNormals[pi].data()[1], _computedNormals[pi].data()[2]));
-            if (uvs.size())
-            {
-                mesh.uvs.emplace_back(make_float2(uvs[pi].data()[0], uvs[pi].data()[1]));
-            }
+            GfRange3f bounds;
+            for (const GfVec3f& point : _points)
+                bounds.UnionWith(point);
+            const GfVec3f center = bounds.GetMidpoint();
+            update->boundsCenter = make_float3(center[0], center[1], center[2]);
+            update->boundsRadius = 0.5f * bounds.GetSize().GetLength();
         }
 
+        // points only: the delegate refits the existing geometry,
+        // otherwise its triangles are rebuilt.
     }
 
-    if (HdChangeTracker::IsTransformDirty(*dirtyBits, id)) 
+    // instancer primvars alone (e.g. animated translations) only dirty the
+    // instancer, not the prototype transform.
+    const bool transformDirty = HdChangeTracker::IsTransformDirty(*dirtyBits, id);
+    const bool instancesDirty = !GetInstancerId().IsEmpty() &&
+        (*dirtyBits & (HdChangeTracker::DirtyInstancer | HdChangeTracker::DirtyInstanceIndex));
+    if (transformDirty || instancesDirty)
     {
-        _transform = GfMatrix4f(sceneDelegate->GetTransform(id));
+        if (transformDirty)
+        {
+            _transform = GfMatrix4f(sceneDelegate->GetTransform(id));
+        }
 
-        std::lock_guard<std::mutex> guard(_owner->rendererMutex());
-        auto& mesh = _owner->GetMesh(id);
-        mesh.dirtyTransform = true;
+        if (!update)
+        {
+            update.reset(new HdLighthouse2MeshUpdate());
+            update->handle = _handle;
+        }
 
         if (!GetInstancerId().IsEmpty())
         {
-            const auto& transposed = _transform.GetTranspose();
-
-            // retrieve instance transforms from the instancer.
-            VtMatrix4dArray transforms;
-            HdInstancer* instancer = sceneDelegate->GetRenderIndex().GetInstancer(GetInstancerId());
-            transforms = static_cast<HdLighthouse2Instancer*>(instancer)->ComputeInstanceTransforms(GetId());
-
-            // apply instance transforms on top of mesh transforms
-            if( transforms.size() != mesh.transforms.size() )
-                mesh.transforms.resize(transforms.size());
-
-            for (size_t j = 0; j < transforms.size(); ++j)
+            // retrieve instance transforms from the instancer,
+            // applied on top of mesh transforms.
+            HdLighthouse2Instancer* instancer = static_cast<HdLighthouse2Instancer*>(
+                sceneDelegate->GetRenderIndex().GetInstancer(GetInstancerId()));
+
+            // the instancer knows which instances its last sync moved,
+            // only those are recomputed and sent.
+            if (!transformDirty && !(*dirtyBits & HdChangeTracker::DirtyInstanceIndex) &&
+                instancer->ComputeChangedInstanceTransforms(GetId(), _transform,
+                    update->changedInstances, update->changedTransforms, update->changedAttributes))
             {
-                GfMatrix4f xform = (_transform * GfMatrix4f(transforms[j])).GetTranspose();
-                for (int i = 0; i < 16; ++i)
-                {
-                    mesh.transforms[j].cell[i] = xform.data()[i];
-                }
-                //mesh.transforms[j].path = GetId().GetString() + "_Instance" + std::to_string(j);
-                //mesh.transforms[j].properties[Aurora::Names::InstanceProperties::kTransform] =
-                //    GfMatrix4fToGLM(&xform);
+                update->hasChangedTransforms = !update->changedInstances.empty();
+            }
+            else
+            {
+                update->hasTransforms = true;
+                update->instanced = true;
+                instancer->ComputeInstanceTransforms(GetId(), _transform, update->transforms);
+                instancer->ComputeInstanceAttributes(GetId(), update->attributes);
             }
         }
         else
         {
+            update->hasTransforms = true;
             const auto& transposed = _transform.GetTranspose();
-            if( mesh.transforms.size() != 1 )
-                mesh.transforms.resize(1);
+            update->transforms.resize(1);
             for (int i = 0; i < 16; ++i)
             {
-                mesh.transforms[0].cell[i] = transposed.data()[i];
+                update->transforms[0].cell[i] = transposed.data()[i];
             }
         }
 
+        if (!update->hasGeometry && !update->hasMaterial && !update->hasTransforms && !update->hasChangedTransforms)
+        {
+            // nothing moved
+            update.reset();
+        }
     }
 
+    if (update)
+    {
+        _owner->EnqueueSceneUpdate(std::move(update));
+    }
 
     // Clean all dirty bits.
     *dirtyBits &= ~HdChangeTracker::AllSceneDirtyBits;
 }
 
+bool
+HdLighthouse2Mesh::_UpdateTopologyCache()
+{
+    const HdTopology::ID topologyHash = _topology.ComputeHash();
+    if (_sharedTopology && topologyHash == _topologyHash)
+    {
+        return false;
+    }
+
+    // the instance holds the registry lock for this key while alive, so
+    // only the first mesh with this topology builds the shared data.
+    {
+        std::shared_lock<std::shared_mutex> registryLock(_owner->GetTopologyRegistryMutex());
+        HdInstance<HdLighthouse2TopologySharedPtr> topologyInstance =
+            _owner->GetTopologyRegistry().GetInstance(topologyHash);
+        if (topologyInstance.IsFirstInstance())
+        {
+            topologyInstance.SetValue(std::make_shared<HdLighthouse2Topology>(_topology, GetId()));
+        }
+        _sharedTopology = topologyInstance.GetValue();
+    }
+
+    _topologyHash = topologyHash;
+    _normalsValid = false;
+    return true;
+}
+
+size_t
+HdLighthouse2Mesh::_ComputeGeometryHash(uint64_t materialHash) const
+{
+    uint64_t hash = TfHash::Combine(_topologyHash, materialHash);
+    hash = ArchHash64((const char*)_points.cdata(), _points.size() * sizeof(GfVec3f), hash);
+    hash = ArchHash64((const char*)_uvs.cdata(), _uvs.size() * sizeof(GfVec2f), hash);
+    hash = ArchHash64((const char*)_st.cdata(), _st.size() * sizeof(GfVec2f), hash);
+    // 0 means "not shared"
+    return hash != 0 ? (size_t)hash : 1;
+}
+
+HdLighthouse2Topology::HdLighthouse2Topology(HdMeshTopology const& i_topology, SdfPath const& id)
+    : topology(i_topology)
+{
+    HdMeshUtil meshUtil(&topology, id);
+    meshUtil.ComputeTriangleIndices(&triangulatedIndices, &trianglePrimitiveParams);
+    adjacency.BuildAdjacencyTable(&topology);
+}
+
+VtVec3iArray const&
+HdLighthouse2Topology::GetFaceVaryingTriangulation() const
+{
+    std::call_once(_faceVaryingOnce, [this]()
+    {
+        // Triangulating a topology whose face-vertex indices are 0..N-1 gives,
+        // for each triangle corner, the face-varying slot it has been built from.
+        const VtIntArray& faceVertexIndices = topology.GetFaceVertexIndices();
+        VtIntArray faceVaryingIndices(faceVertexIndices.size());
+        for (size_t i = 0; i < faceVaryingIndices.size(); ++i)
+        {
+            faceVaryingIndices[i] = (int)i;
+        }
+        HdMeshTopology faceVaryingTopology(
+            topology.GetScheme(),
+            topology.GetOrientation(),
+            topology.GetFaceVertexCounts(),
+            faceVaryingIndices,
+            topology.GetHoleIndices());
+
+        VtIntArray primitiveParams;
+        HdMeshUtil meshUtil(&faceVaryingTopology, SdfPath::EmptyPath());
+        meshUtil.ComputeTriangleIndices(&_faceVaryingTriangulation, &primitiveParams);
+    });
+    return _faceVaryingTriangulation;
+}
 
 PXR_NAMESPACE_CLOSE_SCOPE
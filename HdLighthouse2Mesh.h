@@ -9,11 +9,34 @@
 #include <pxr/base/gf/matrix4f.h>
 #include <pxr/imaging/hd/meshUtil.h>
 
+#include <mutex>
+
 #include "HdLighthouse2RenderDelegate.h"
 #include "HdLighthouse2Material.h"
 
 PXR_NAMESPACE_OPEN_SCOPE
 
+// Everything derived from the topology alone, shared through the delegate
+// topology registry by all meshes with the same topology hash.
+struct HdLighthouse2Topology
+{
+    HdLighthouse2Topology(HdMeshTopology const& topology, SdfPath const& id);
+
+    // Map every triangulated face-varying slot to its authored face-varying
+    // index, so face-varying primvars can be triangulated with a gather.
+    // Built on first use, thread-safe.
+    VtVec3iArray const& GetFaceVaryingTriangulation() const;
+
+    HdMeshTopology topology;
+    VtVec3iArray triangulatedIndices;
+    VtIntArray trianglePrimitiveParams;
+    Hd_VertexAdjacency adjacency;
+
+private:
+    mutable std::once_flag _faceVaryingOnce;
+    mutable VtVec3iArray _faceVaryingTriangulation;
+};
+
 class HdLighthouse2Mesh final : public HdMesh 
 {
 public:
@@ -43,15 +66,25 @@ private:
         HdDirtyBits* dirtyBits,
         HdMeshReprDesc const& desc);
 
+    // Fetch triangulation and adjacency from the delegate topology registry
+    // if the topology hash changed. Returns true if they changed.
+    bool _UpdateTopologyCache();
+
+    // Hash of topology, points, uvs and material, used by the delegate to
+    // share identical geometry between prims. Never 0.
+    size_t _ComputeGeometryHash(uint64_t materialHash) const;
+
 private:
     HdMeshTopology _topology;
     GfMatrix4f _transform;
     VtVec3fArray _points;
-    VtVec3iArray _triangulatedIndices;
-    VtIntArray _trianglePrimitiveParams;
-    VtVec3fArray _computedNormals;
-    Hd_VertexAdjacency _adjacency;
-    bool _adjacencyValid;
+    // shared topology data, keyed by _topologyHash
+    HdTopology::ID _topologyHash;
+    HdLighthouse2TopologySharedPtr _sharedTopology;
+    // primvars of interest, refreshed only when primvars or topology change
+    VtVec2fArray _uvs;
+    VtVec2fArray _st;
+    bool _primvarsValid;
     bool _normalsValid;
     bool _refined;
     bool _smoothNormals;
@@ -67,6 +100,7 @@ private:
     HdLighthouse2Mesh& operator =(const HdLighthouse2Mesh&) = delete;
 
     HdLighthouse2RenderDelegate* _owner;
+    HdLighthouse2Handle _handle;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
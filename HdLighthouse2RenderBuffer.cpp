@@ -2,6 +2,23 @@
 #include <pxr/base/gf/half.h>
 #include <pxr/base/gf/vec3i.h>
 
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define HDLIGHTHOUSE2_F16C_DISPATCH
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
 #include "platform.h"
 #include "rendersystem.h"
 
@@ -16,6 +33,7 @@ HdLighthouse2RenderBuffer::HdLighthouse2RenderBuffer(SdfPath const& id)
     , _buffer()
     , _sampleBuffer()
     , _sampleCount()
+    , _tileSampleCount()
     , _mappers(0)
     , _converged(false)
 {
@@ -65,6 +83,7 @@ HdLighthouse2RenderBuffer::_Deallocate()
     _buffer.resize(0);
     _sampleBuffer.resize(0);
     _sampleCount.resize(0);
+    _tileSampleCount.resize(0);
 
     _mappers.store(0);
     _converged.store(false);
@@ -126,32 +145,193 @@ HdLighthouse2RenderBuffer::Allocate(GfVec3i const& dimensions,
         _sampleBuffer.resize(_GetBufferSize(GfVec2i(_width, _height),
             _GetSampleFormat(format)));
         _sampleCount.resize(_width * _height);
+        _tileSampleCount.resize(GetTileCountX() * GetTileCountY());
     }
 
     return true;
 }
 
-template<typename T>
-static void _WriteSample(HdFormat format, uint8_t* dst,
-    size_t valueComponents, T const* value)
+// Rows per task in the parallel loops, small buffers stay on one thread.
+static const unsigned int kRowGrainSize = 16;
+
+template<typename F>
+static void _ForEachRow(unsigned int numRows, F const& f)
 {
-    HdFormat componentFormat = HdGetComponentFormat(format);
-    size_t componentCount = HdGetComponentCount(format);
+    tbb::parallel_for(tbb::blocked_range<unsigned int>(0, numRows, kRowGrainSize),
+        [&](const tbb::blocked_range<unsigned int>& r)
+        {
+            for (unsigned int row = r.begin(); row != r.end(); ++row) {
+                f(row);
+            }
+        });
+}
 
-    for (size_t c = 0; c < componentCount; ++c) {
-        if (componentFormat == HdFormatInt32) {
-            ((int32_t*)dst)[c] +=
-                (c < valueComponents) ? (int32_t)(value[c]) : 0;
+// Conversion to one component format, picked at compile time so that the
+// pixel loops don't switch on the format.
+template<HdFormat Component> struct _Component;
+
+template<> struct _Component<HdFormatUNorm8> {
+    using Type = uint8_t;
+    template<typename T> static Type Convert(T v) {
+        return (uint8_t)(v * 255.0f);
+    }
+};
+
+template<> struct _Component<HdFormatSNorm8> {
+    using Type = int8_t;
+    template<typename T> static Type Convert(T v) {
+        return (int8_t)(v * 127.0f);
+    }
+};
+
+template<> struct _Component<HdFormatFloat16> {
+    using Type = uint16_t;
+    template<typename T> static Type Convert(T v) {
+        return GfHalf((float)v).bits();
+    }
+};
+
+template<> struct _Component<HdFormatFloat32> {
+    using Type = float;
+    template<typename T> static Type Convert(T v) { return (float)v; }
+};
+
+template<> struct _Component<HdFormatInt32> {
+    using Type = int32_t;
+    template<typename T> static Type Convert(T v) { return (int32_t)v; }
+};
+
+#ifdef HDLIGHTHOUSE2_F16C_DISPATCH
+// F16C is not part of the x64 baseline the plugin is built for: only this
+// function is compiled for it, and it is only called if the CPU has it and
+// the OS saves the AVX registers.
+static bool _HasF16C()
+{
+    unsigned int ecx;
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    ecx = (unsigned int)info[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+#endif
+    const unsigned int osxsave = 1u << 27, avx = 1u << 28, f16c = 1u << 29;
+    if ((ecx & (osxsave | avx | f16c)) != (osxsave | avx | f16c))
+        return false;
+#if defined(_MSC_VER)
+    const unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0Low, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    const unsigned long long xcr0 = xcr0Low;
+#endif
+    return (xcr0 & 0x6) == 0x6;
+}
+
+// Converts the first count & ~7 values, returns how many.
+#if !defined(_MSC_VER)
+__attribute__((target("avx,f16c")))
+#endif
+static size_t _FloatToHalfF16C(uint16_t* dst, float const* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i half = _mm256_cvtps_ph(
+            _mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+    }
+    return i;
+}
+#endif
+
+static void _FloatToHalf(uint16_t* dst, float const* src, size_t count)
+{
+    size_t i = 0;
+#ifdef HDLIGHTHOUSE2_F16C_DISPATCH
+    static const bool hasF16C = _HasF16C();
+    if (hasF16C) {
+        i = _FloatToHalfF16C(dst, src, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = GfHalf(src[i]).bits();
+    }
+}
+
+// Convert count contiguous components.
+template<HdFormat Component, typename T>
+static void _ConvertRun(typename _Component<Component>::Type* dst,
+    T const* src, size_t count)
+{
+    if constexpr (Component == HdFormatFloat32 && std::is_same<T, float>::value) {
+        memcpy(dst, src, count * sizeof(float));
+    }
+    else if constexpr (Component == HdFormatInt32 && std::is_same<T, int>::value) {
+        memcpy(dst, src, count * sizeof(int32_t));
+    }
+    else if constexpr (Component == HdFormatFloat16 && std::is_same<T, float>::value) {
+        _FloatToHalf(dst, src, count);
+    }
+    else {
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = _Component<Component>::Convert(src[i]);
         }
-        else {
-            ((float*)dst)[c] +=
-                (c < valueComponents) ? (float)(value[c]) : 0.0f;
+    }
+}
+
+// Convert numPixels pixels. Extra source components are discarded, missing
+// ones are taken as 0.
+template<HdFormat Component, typename T>
+static void _ConvertPixels(uint8_t* dst, size_t dstComponents,
+    T const* src, size_t srcComponents, size_t numPixels)
+{
+    using Type = typename _Component<Component>::Type;
+    Type* out = reinterpret_cast<Type*>(dst);
+
+    if (dstComponents == srcComponents) {
+        _ConvertRun<Component>(out, src, numPixels * dstComponents);
+        return;
+    }
+    for (size_t i = 0; i < numPixels;
+        ++i, out += dstComponents, src += srcComponents) {
+        for (size_t c = 0; c < dstComponents; ++c) {
+            out[c] = (c < srcComponents) ?
+                _Component<Component>::Convert(src[c]) : Type(0);
         }
     }
 }
 
 template<typename T>
-static void _WriteOutput(HdFormat format, uint8_t* dst,
+static void _ConvertPixels(HdFormat format, uint8_t* dst,
+    T const* src, size_t srcComponents, size_t numPixels)
+{
+    const size_t componentCount = HdGetComponentCount(format);
+
+    switch (HdGetComponentFormat(format)) {
+    case HdFormatUNorm8:
+        _ConvertPixels<HdFormatUNorm8>(dst, componentCount, src, srcComponents, numPixels);
+        break;
+    case HdFormatSNorm8:
+        _ConvertPixels<HdFormatSNorm8>(dst, componentCount, src, srcComponents, numPixels);
+        break;
+    case HdFormatFloat16:
+        _ConvertPixels<HdFormatFloat16>(dst, componentCount, src, srcComponents, numPixels);
+        break;
+    case HdFormatFloat32:
+        _ConvertPixels<HdFormatFloat32>(dst, componentCount, src, srcComponents, numPixels);
+        break;
+    case HdFormatInt32:
+        _ConvertPixels<HdFormatInt32>(dst, componentCount, src, srcComponents, numPixels);
+        break;
+    default:
+        break;
+    }
+}
+
+template<typename T>
+static void _WriteSample(HdFormat format, uint8_t* dst,
     size_t valueComponents, T const* value)
 {
     HdFormat componentFormat = HdGetComponentFormat(format);
@@ -159,25 +339,13 @@ static void _WriteOutput(HdFormat format, uint8_t* dst,
 
     for (size_t c = 0; c < componentCount; ++c) {
         if (componentFormat == HdFormatInt32) {
-            ((int32_t*)dst)[c] =
+            ((int32_t*)dst)[c] +=
                 (c < valueComponents) ? (int32_t)(value[c]) : 0;
         }
-        else if (componentFormat == HdFormatFloat16) {
-            ((uint16_t*)dst)[c] =
-                (c < valueComponents) ? GfHalf(value[c]).bits() : 0;
-        }
-        else if (componentFormat == HdFormatFloat32) {
-            ((float*)dst)[c] =
+        else {
+            ((float*)dst)[c] +=
                 (c < valueComponents) ? (float)(value[c]) : 0.0f;
         }
-        else if (componentFormat == HdFormatUNorm8) {
-            ((uint8_t*)dst)[c] =
-                (c < valueComponents) ? (uint8_t)(value[c] * 255.0f) : 0.0f;
-        }
-        else if (componentFormat == HdFormatSNorm8) {
-            ((int8_t*)dst)[c] =
-                (c < valueComponents) ? (int8_t)(value[c] * 127.0f) : 0.0f;
-        }
     }
 }
 
@@ -195,7 +363,7 @@ HdLighthouse2RenderBuffer::Write(
     else {
         size_t formatSize = HdDataSizeOfFormat(_format);
         uint8_t* dst = &_buffer[idx * formatSize];
-        _WriteOutput(_format, dst, numComponents, value);
+        _ConvertPixels(_format, dst, value, numComponents, 1);
     }
 }
 
@@ -213,87 +381,293 @@ HdLighthouse2RenderBuffer::Write(
     else {
         size_t formatSize = HdDataSizeOfFormat(_format);
         uint8_t* dst = &_buffer[idx * formatSize];
-        _WriteOutput(_format, dst, numComponents, value);
+        _ConvertPixels(_format, dst, value, numComponents, 1);
     }
 }
 
+template<typename T>
 void
-HdLighthouse2RenderBuffer::Clear(size_t numComponents, float const* value)
+HdLighthouse2RenderBuffer::_WriteTile(unsigned int x, unsigned int y,
+    unsigned int width, unsigned int height, size_t numComponents,
+    T const* src, ptrdiff_t srcStride)
 {
-    size_t formatSize = HdDataSizeOfFormat(_format);
-    for (size_t i = 0; i < _width * _height; ++i) {
-        uint8_t* dst = &_buffer[i * formatSize];
-        _WriteOutput(_format, dst, numComponents, value);
+    if (x >= _width || y >= _height) {
+        return;
     }
+    width = std::min(width, _width - x);
+    height = std::min(height, _height - y);
+    uint8_t const* srcTile = reinterpret_cast<uint8_t const*>(src);
 
+    // Multisampled buffers accumulate, go through Write.
     if (_multiSampled) {
-        std::fill(_sampleCount.begin(), _sampleCount.end(), 0);
-        std::fill(_sampleBuffer.begin(), _sampleBuffer.end(), 0);
+        for (unsigned int r = 0; r < height; ++r) {
+            T const* value =
+                reinterpret_cast<T const*>(srcTile + r * srcStride);
+            for (unsigned int c = 0; c < width; ++c, value += numComponents) {
+                Write(GfVec3i(x + c, y + r, 0), numComponents, value);
+            }
+        }
+        return;
     }
+
+    const size_t formatSize = HdDataSizeOfFormat(_format);
+    const size_t rowSize = _width * formatSize;
+    uint8_t* dstTile = &_buffer[y * rowSize + x * formatSize];
+    _ForEachRow(height, [&](unsigned int r)
+    {
+        _ConvertPixels(_format, dstTile + r * rowSize,
+            reinterpret_cast<T const*>(srcTile + r * srcStride),
+            numComponents, width);
+    });
 }
 
 void
-HdLighthouse2RenderBuffer::Clear(size_t numComponents, int const* value)
+HdLighthouse2RenderBuffer::WriteRows(unsigned int y, unsigned int numRows,
+    size_t numComponents, float const* src, ptrdiff_t srcStride)
 {
-    size_t formatSize = HdDataSizeOfFormat(_format);
-    for (size_t i = 0; i < _width * _height; ++i) {
-        uint8_t* dst = &_buffer[i * formatSize];
-        _WriteOutput(_format, dst, numComponents, value);
+    _WriteTile(0, y, _width, numRows, numComponents, src, srcStride);
+}
+
+void
+HdLighthouse2RenderBuffer::WriteRows(unsigned int y, unsigned int numRows,
+    size_t numComponents, int const* src, ptrdiff_t srcStride)
+{
+    _WriteTile(0, y, _width, numRows, numComponents, src, srcStride);
+}
+
+void
+HdLighthouse2RenderBuffer::WriteTile(unsigned int x, unsigned int y,
+    unsigned int width, unsigned int height, size_t numComponents,
+    float const* src, ptrdiff_t srcStride)
+{
+    _WriteTile(x, y, width, height, numComponents, src, srcStride);
+}
+
+void
+HdLighthouse2RenderBuffer::WriteTile(unsigned int x, unsigned int y,
+    unsigned int width, unsigned int height, size_t numComponents,
+    int const* src, ptrdiff_t srcStride)
+{
+    _WriteTile(x, y, width, height, numComponents, src, srcStride);
+}
+
+// Add a row of source pixels to a row of samples. Extra source components
+// are discarded, missing ones add 0.
+template<typename S, typename T>
+static void _AccumulateRow(S* dst, size_t sampleComponents,
+    T const* src, size_t srcComponents, unsigned int width)
+{
+    const size_t components = std::min(sampleComponents, srcComponents);
+    for (unsigned int x = 0; x < width;
+        ++x, dst += sampleComponents, src += srcComponents) {
+        for (size_t c = 0; c < components; ++c) {
+            dst[c] += (S)src[c];
+        }
+    }
+}
+
+template<typename T>
+void
+HdLighthouse2RenderBuffer::_AccumulateTile(unsigned int tileX,
+    unsigned int tileY, size_t numComponents, T const* src,
+    ptrdiff_t srcStride)
+{
+    const unsigned int x = tileX * TILE_SIZE;
+    const unsigned int y = tileY * TILE_SIZE;
+    if (!_multiSampled) {
+        _WriteTile(x, y, TILE_SIZE, TILE_SIZE, numComponents, src, srcStride);
+        return;
+    }
+    if (tileX >= GetTileCountX() || tileY >= GetTileCountY()) {
+        return;
+    }
+
+    const unsigned int width = std::min(TILE_SIZE, _width - x);
+    const unsigned int height = std::min(TILE_SIZE, _height - y);
+    const size_t sampleComponents = HdGetComponentCount(_format);
+    const size_t sampleSize = HdDataSizeOfFormat(_GetSampleFormat(_format));
+    const bool intSamples = HdGetComponentFormat(_format) == HdFormatInt32;
+    uint8_t const* srcRow = reinterpret_cast<uint8_t const*>(src);
+
+    // Only this tile's pixels and counter are touched.
+    for (unsigned int r = 0; r < height; ++r, srcRow += srcStride) {
+        uint8_t* dst = &_sampleBuffer[((y + r) * _width + x) * sampleSize];
+        T const* value = reinterpret_cast<T const*>(srcRow);
+        if (intSamples) {
+            _AccumulateRow((int32_t*)dst, sampleComponents,
+                value, numComponents, width);
+        }
+        else {
+            _AccumulateRow((float*)dst, sampleComponents,
+                value, numComponents, width);
+        }
+    }
+    _tileSampleCount[tileY * GetTileCountX() + tileX]++;
+}
+
+void
+HdLighthouse2RenderBuffer::AccumulateTile(unsigned int tileX,
+    unsigned int tileY, size_t numComponents, float const* src,
+    ptrdiff_t srcStride)
+{
+    _AccumulateTile(tileX, tileY, numComponents, src, srcStride);
+}
+
+void
+HdLighthouse2RenderBuffer::AccumulateTile(unsigned int tileX,
+    unsigned int tileY, size_t numComponents, int const* src,
+    ptrdiff_t srcStride)
+{
+    _AccumulateTile(tileX, tileY, numComponents, src, srcStride);
+}
+
+template<typename T>
+void
+HdLighthouse2RenderBuffer::_Clear(size_t numComponents, T const* value)
+{
+    const size_t formatSize = HdDataSizeOfFormat(_format);
+    const size_t rowSize = _width * formatSize;
+    if (rowSize == 0) {
+        return;
+    }
+
+    // Convert the value once, then replicate it: doubling within the first
+    // row, then copying that row to every other.
+    std::vector<uint8_t> row(rowSize);
+    _ConvertPixels(_format, row.data(), value, numComponents, 1);
+    for (size_t filled = formatSize; filled < rowSize; filled *= 2) {
+        memcpy(row.data() + filled, row.data(),
+            std::min(filled, rowSize - filled));
     }
+    _ForEachRow(_height, [&](unsigned int y)
+    {
+        memcpy(&_buffer[y * rowSize], row.data(), rowSize);
+    });
 
     if (_multiSampled) {
         std::fill(_sampleCount.begin(), _sampleCount.end(), 0);
+        std::fill(_tileSampleCount.begin(), _tileSampleCount.end(), 0);
         std::fill(_sampleBuffer.begin(), _sampleBuffer.end(), 0);
     }
 }
 
-/*virtual*/
 void
-HdLighthouse2RenderBuffer::Resolve()
+HdLighthouse2RenderBuffer::Clear(size_t numComponents, float const* value)
 {
-    // Resolve the image buffer: find the average value per pixel by
-    // dividing the summed value by the number of samples.
+    _Clear(numComponents, value);
+}
 
-    if (!_multiSampled) {
-        return;
-    }
+void
+HdLighthouse2RenderBuffer::Clear(size_t numComponents, int const* value)
+{
+    _Clear(numComponents, value);
+}
 
-    HdFormat componentFormat = HdGetComponentFormat(_format);
-    size_t componentCount = HdGetComponentCount(_format);
-    size_t formatSize = HdDataSizeOfFormat(_format);
-    size_t sampleSize = HdDataSizeOfFormat(_GetSampleFormat(_format));
+// Average the samples of one row, skipping pixels with no samples. Runs of
+// sampled pixels are scaled into scratch and converted in bulk.
+template<HdFormat Component>
+static void _ResolveRow(uint8_t* dst, float const* samples,
+    uint32_t const* sampleCounts, unsigned int width, size_t componentCount,
+    std::vector<float>& scratch)
+{
+    using Type = typename _Component<Component>::Type;
+    Type* out = reinterpret_cast<Type*>(dst);
 
-    for (unsigned int i = 0; i < _width * _height; ++i) {
+    unsigned int x = 0;
+    while (x < width) {
+        if (sampleCounts[x] == 0) {
+            ++x;
+            continue;
+        }
+        const unsigned int begin = x;
+        size_t count = 0;
+        for (; x < width && sampleCounts[x] != 0; ++x) {
+            const float scale = 1.0f / sampleCounts[x];
+            for (size_t c = 0; c < componentCount; ++c, ++count) {
+                scratch[count] = samples[x * componentCount + c] * scale;
+            }
+        }
+        _ConvertRun<Component>(out + begin * componentCount,
+            scratch.data(), count);
+    }
+}
 
-        int sampleCount = _sampleCount[i];
-        // Skip pixels with no samples.
+static void _ResolveIntRow(int32_t* dst, int32_t const* samples,
+    uint32_t const* sampleCounts, unsigned int width, size_t componentCount)
+{
+    for (unsigned int x = 0; x < width; ++x) {
+        const int32_t sampleCount = (int32_t)sampleCounts[x];
         if (sampleCount == 0) {
             continue;
         }
-
-        uint8_t* dst = &_buffer[i * formatSize];
-        uint8_t* src = &_sampleBuffer[i * sampleSize];
         for (size_t c = 0; c < componentCount; ++c) {
-            if (componentFormat == HdFormatInt32) {
-                ((int32_t*)dst)[c] = ((int32_t*)src)[c] / sampleCount;
-            }
-            else if (componentFormat == HdFormatFloat16) {
-                ((uint16_t*)dst)[c] = GfHalf(
-                    ((float*)src)[c] / sampleCount).bits();
-            }
-            else if (componentFormat == HdFormatFloat32) {
-                ((float*)dst)[c] = ((float*)src)[c] / sampleCount;
-            }
-            else if (componentFormat == HdFormatUNorm8) {
-                ((uint8_t*)dst)[c] = (uint8_t)
-                    (((float*)src)[c] * 255.0f / sampleCount);
-            }
-            else if (componentFormat == HdFormatSNorm8) {
-                ((int8_t*)dst)[c] = (int8_t)
-                    (((float*)src)[c] * 127.0f / sampleCount);
-            }
+            dst[x * componentCount + c] =
+                samples[x * componentCount + c] / sampleCount;
         }
     }
 }
 
+/*virtual*/
+void
+HdLighthouse2RenderBuffer::Resolve()
+{
+    // Resolve the image buffer: find the average value per pixel by
+    // dividing the summed value by the number of samples.
+
+    if (!_multiSampled) {
+        return;
+    }
+
+    const HdFormat componentFormat = HdGetComponentFormat(_format);
+    const size_t componentCount = HdGetComponentCount(_format);
+    const size_t rowSize = _width * HdDataSizeOfFormat(_format);
+    const size_t sampleRowSize =
+        _width * HdDataSizeOfFormat(_GetSampleFormat(_format));
+
+    tbb::parallel_for(tbb::blocked_range<unsigned int>(0, _height, kRowGrainSize),
+        [&](const tbb::blocked_range<unsigned int>& r)
+        {
+            std::vector<float> scratch(_width * componentCount);
+            std::vector<uint32_t> rowCounts(_width);
+            for (unsigned int y = r.begin(); y != r.end(); ++y) {
+                uint8_t* dst = &_buffer[y * rowSize];
+                uint8_t const* src = &_sampleBuffer[y * sampleRowSize];
+
+                // merge the per-pixel counts with their tile's
+                uint32_t const* pixelCounts = &_sampleCount[y * _width];
+                uint32_t const* tileCounts =
+                    &_tileSampleCount[(y / TILE_SIZE) * GetTileCountX()];
+                for (unsigned int x = 0; x < _width; ++x) {
+                    rowCounts[x] = pixelCounts[x] + tileCounts[x / TILE_SIZE];
+                }
+                uint32_t const* counts = rowCounts.data();
+
+                switch (componentFormat) {
+                case HdFormatInt32:
+                    _ResolveIntRow((int32_t*)dst, (int32_t const*)src,
+                        counts, _width, componentCount);
+                    break;
+                case HdFormatFloat16:
+                    _ResolveRow<HdFormatFloat16>(dst, (float const*)src,
+                        counts, _width, componentCount, scratch);
+                    break;
+                case HdFormatFloat32:
+                    _ResolveRow<HdFormatFloat32>(dst, (float const*)src,
+                        counts, _width, componentCount, scratch);
+                    break;
+                case HdFormatUNorm8:
+                    _ResolveRow<HdFormatUNorm8>(dst, (float const*)src,
+                        counts, _width, componentCount, scratch);
+                    break;
+                case HdFormatSNorm8:
+                    _ResolveRow<HdFormatSNorm8>(dst, (float const*)src,
+                        counts, _width, componentCount, scratch);
+                    break;
+                default:
+                    break;
+                }
+            }
+        });
+}
+
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -4,6 +4,8 @@
 #include <pxr/pxr.h>
 #include <pxr/imaging/hd/renderBuffer.h>
 
+#include <cstddef>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdLighthouse2RenderBuffer : public HdRenderBuffer
@@ -104,7 +106,8 @@ public:
     /// Write a float, vec2f, vec3f, or vec4f to the renderbuffer.
     /// This should only be called on a mapped buffer. Extra components will
     /// be silently discarded; if not enough are provided for the buffer, the
-    /// remainder will be taken as 0.
+    /// remainder will be taken as 0. Multisampled writes to the same tile
+    /// must come from one thread at a time, see AccumulateTile.
     ///   \param pixel         What index to write
     ///   \param numComponents The arity of the value to write.
     ///   \param value         A float-valued vector to write. 
@@ -135,7 +138,90 @@ public:
     ///   \param value         An int-valued vector to write. 
     void Clear(size_t numComponents, int const* value);
 
+    /// Write whole rows of float pixels, converted to the buffer format.
+    /// This should only be called on a mapped buffer. Rows are converted
+    /// in parallel, and copied as is when the source matches the format.
+    ///   \param y             The first row to write.
+    ///   \param numRows       How many rows to write.
+    ///   \param numComponents The arity of the source pixels.
+    ///   \param src           The first pixel of row y.
+    ///   \param srcStride     Bytes from one source row to the next, negative
+    ///                        to flip the image.
+    void WriteRows(unsigned int y, unsigned int numRows, size_t numComponents,
+        float const* src, ptrdiff_t srcStride);
+
+    /// Write whole rows of int pixels, see the float version.
+    void WriteRows(unsigned int y, unsigned int numRows, size_t numComponents,
+        int const* src, ptrdiff_t srcStride);
+
+    /// Write a rectangle of float pixels, converted to the buffer format.
+    /// This should only be called on a mapped buffer. The tile is clipped
+    /// to the buffer.
+    ///   \param x             The first column to write.
+    ///   \param y             The first row to write.
+    ///   \param width         How many pixels to write per row.
+    ///   \param height        How many rows to write.
+    ///   \param numComponents The arity of the source pixels.
+    ///   \param src           The first pixel of the tile.
+    ///   \param srcStride     Bytes from one source row to the next.
+    void WriteTile(unsigned int x, unsigned int y,
+        unsigned int width, unsigned int height, size_t numComponents,
+        float const* src, ptrdiff_t srcStride);
+
+    /// Write a rectangle of int pixels, see the float version.
+    void WriteTile(unsigned int x, unsigned int y,
+        unsigned int width, unsigned int height, size_t numComponents,
+        int const* src, ptrdiff_t srcStride);
+
+    // ---------------------------------------------------------------------- //
+    /// \name Tiled accumulation
+    // ---------------------------------------------------------------------- //
+
+    /// Side of the square tiles of a multisampled buffer, in pixels.
+    static constexpr unsigned int TILE_SIZE = 16;
+
+    /// Number of tiles across the buffer.
+    unsigned int GetTileCountX() const {
+        return (_width + TILE_SIZE - 1) / TILE_SIZE;
+    }
+
+    /// Number of tiles down the buffer.
+    unsigned int GetTileCountY() const {
+        return (_height + TILE_SIZE - 1) / TILE_SIZE;
+    }
+
+    /// Add one sample to every pixel of a tile of a multisampled buffer,
+    /// counted once for the whole tile. Tiles are disjoint, so different
+    /// tiles can be accumulated from different threads concurrently; a tile
+    /// must not be accumulated or written with Write from two threads at
+    /// once. On a buffer that isn't multisampled this is WriteTile.
+    /// This should only be called on a mapped buffer.
+    ///   \param tileX         Column of the tile, in tiles.
+    ///   \param tileY         Row of the tile, in tiles.
+    ///   \param numComponents The arity of the source pixels.
+    ///   \param src           The first pixel of the tile, clipped to the
+    ///                        buffer at its right and top edges.
+    ///   \param srcStride     Bytes from one source row to the next.
+    void AccumulateTile(unsigned int tileX, unsigned int tileY,
+        size_t numComponents, float const* src, ptrdiff_t srcStride);
+
+    /// Add an int-valued sample to a tile, see the float version.
+    void AccumulateTile(unsigned int tileX, unsigned int tileY,
+        size_t numComponents, int const* src, ptrdiff_t srcStride);
+
 private:
+    template<typename T>
+    void _AccumulateTile(unsigned int tileX, unsigned int tileY,
+        size_t numComponents, T const* src, ptrdiff_t srcStride);
+
+    // Shared implementations of the float and int overloads.
+    template<typename T>
+    void _WriteTile(unsigned int x, unsigned int y,
+        unsigned int width, unsigned int height, size_t numComponents,
+        T const* src, ptrdiff_t srcStride);
+    template<typename T>
+    void _Clear(size_t numComponents, T const* value);
+
     // Calculate the needed buffer size, given the allocation parameters.
     static size_t _GetBufferSize(GfVec2i const& dims, HdFormat format);
 
@@ -160,8 +246,11 @@ private:
     std::vector<uint8_t> _buffer;
     // For multisampled buffers: the input write buffer.
     std::vector<uint8_t> _sampleBuffer;
-    // For multisampled buffers: the sample count buffer.
-    std::vector<uint8_t> _sampleCount;
+    // For multisampled buffers: the per-pixel sample count, from Write.
+    std::vector<uint32_t> _sampleCount;
+    // For multisampled buffers: the per-tile sample count, from
+    // AccumulateTile. A pixel has its count plus its tile's.
+    std::vector<uint32_t> _tileSampleCount;
 
     // The number of callers mapping this buffer.
     std::atomic<int> _mappers;
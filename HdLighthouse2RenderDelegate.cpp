@@ -16,30 +16,34 @@
 
 #include <pxr/imaging/glf/glContext.h>
 
+#include <chrono>
+#include <cstring>
+#include <unordered_set>
 #include <iostream>
+#include <thread>
 
 PXR_NAMESPACE_USING_DIRECTIVE
 
+TF_DEFINE_PRIVATE_TOKENS(
+    _lighthouse2Tokens,
+    ((instanceCulling, "lighthouse2:instanceCulling"))
+    ((cullMinPixelSize, "lighthouse2:cullMinPixelSize"))
+    ((cullMargin, "lighthouse2:cullMargin"))
+);
+
 std::mutex HdLighthouse2RenderDelegate::_mutexResourceRegistry;
 std::atomic_int HdLighthouse2RenderDelegate::_counterResourceRegistry;
 HdResourceRegistrySharedPtr HdLighthouse2RenderDelegate::_resourceRegistry;
 
+std::shared_ptr<pxr::HdInstanceRegistry<HdLighthouse2TopologySharedPtr>> HdLighthouse2RenderDelegate::_topologyRegistry;
+std::shared_mutex HdLighthouse2RenderDelegate::_topologyRegistryMutex;
+
+std::mutex HdLighthouse2RenderDelegate::_ltSceneMutex;
+const HdLighthouse2RenderDelegate* HdLighthouse2RenderDelegate::_ltSceneOwner = nullptr;
 RenderAPI* HdLighthouse2RenderDelegate::_ltRenderer = nullptr;
-GLTexture* HdLighthouse2RenderDelegate::_ltRenderTarget = nullptr;
 Shader* HdLighthouse2RenderDelegate::_ltShader = nullptr;
-uint HdLighthouse2RenderDelegate::_ltCar = 0;
-std::map<pxr::SdfPath, HdLighthouse2RenderDelegate::Lighthouse2Mesh> HdLighthouse2RenderDelegate::_ltMeshes;
-std::map<pxr::SdfPath, HdLighthouse2RenderDelegate::Lighthouse2Mesh> HdLighthouse2RenderDelegate::_ltLights;
-std::map<pxr::SdfPath, HdLighthouse2RenderDelegate::Lighthouse2Material> HdLighthouse2RenderDelegate::_ltMaterials;
-std::map<pxr::SdfPath, pxr::SdfPath > HdLighthouse2RenderDelegate::_ltMeshToMaterialMap;
-int HdLighthouse2RenderDelegate::_ltDefaultMaterial;
-
-static void _RenderCallback(RenderAPI* renderer, Shader* shader, GLTexture*  renderTarget, pxr::HdRenderThread* renderThread)
-{
-    //std::cout << "RENDERING" << std::endl;
-    //renderer->SynchronizeSceneData();
-    //renderer->Render(lighthouse2::Convergence::Restart /* alternative: converge */, true /*async*/);
-}
+std::vector<HostMesh*> HdLighthouse2RenderDelegate::_ltFreeHostMeshes;
+std::vector<HostMaterial*> HdLighthouse2RenderDelegate::_ltFreeMaterials;
 
 const pxr::TfTokenVector HdLighthouse2RenderDelegate::SUPPORTED_RPRIM_TYPES = {
     HdPrimTypeTokens->mesh,
@@ -91,41 +95,78 @@ void HdLighthouse2RenderDelegate::_Initialize()
     // Otherwise all GL calls will fail!
     gladLoadGL();
 
-    if (!_ltRenderer)
+    // one scene per process, see HasScene
     {
-        std::string ltPathStr = "";
-        char* ltPath = getenv("LIGHTHOUSE2_PATH");
-        if (ltPath)
+        std::lock_guard<std::mutex> sceneGuard(_ltSceneMutex);
+        if (_ltSceneOwner == nullptr)
         {
-            ltPathStr = std::string(ltPath) + "/";
-        }
-        std::string vertPath = ltPathStr + "shaders/tonemap.vert";
-        std::string fragPath = ltPathStr + "shaders/tonemap.frag";
-        std::cout << "Lighthouse2 Loading shaders " << vertPath << " " << fragPath << std::endl;
-        _ltShader = new Shader(vertPath.c_str(), fragPath.c_str());
+            _ltSceneOwner = this;
+            _ltOwnsScene = true;
 
-        std::string corePath = ltPathStr + "Lighthouse2/lib/cores/RenderCore_Optix7.dll";
-        std::cout << "Lighthouse2 Loading core DLL " << corePath << std::endl;
-        _ltRenderer = RenderAPI::CreateRenderAPI(corePath.c_str());
-        auto& mat = GetMaterial(pxr::SdfPath("_lighthouse2_default_material_"), make_float3(1, 1, 1));
-        mat.material->ID = _ltRenderer->GetScene()->AddMaterial(mat.material);
-        _ltDefaultMaterial = mat.material->ID;
-        std::cout << "Lighthouse2 renderer ready" << std::endl;
+            std::string ltPathStr = "";
+            char* ltPath = getenv("LIGHTHOUSE2_PATH");
+            if (ltPath)
+            {
+                ltPathStr = std::string(ltPath) + "/";
+            }
+            std::string vertPath = ltPathStr + "shaders/tonemap.vert";
+            std::string fragPath = ltPathStr + "shaders/tonemap.frag";
+            std::cout << "Lighthouse2 Loading shaders " << vertPath << " " << fragPath << std::endl;
+            _ltShader = new Shader(vertPath.c_str(), fragPath.c_str());
+
+            std::string corePath = ltPathStr + "Lighthouse2/lib/cores/RenderCore_Optix7.dll";
+            std::cout << "Lighthouse2 Loading core DLL " << corePath << std::endl;
+            _ltRenderer = RenderAPI::CreateRenderAPI(corePath.c_str());
+
+            auto& mat = GetMaterial(GetMaterialHandle(pxr::SdfPath("_lighthouse2_default_material_"), make_float3(1, 1, 1)));
+            _AddSceneMaterial(mat);
+            _ltDefaultMaterial = mat.material->ID;
+            std::cout << "Lighthouse2 renderer ready" << std::endl;
+        }
+        else
+        {
+            TF_RUNTIME_ERROR("Lighthouse2 renders one scene per process and another "
+                "render delegate is using it, this one will not render");
+        }
     }
 
-    if (!_ltRenderTarget)
+    // NOTE: this will be resized as soon as the renderer draws something
+    //       so any value here is fine.
+    ResizeBuffer(1024, 768);
+
+    // render settings with side effects, culling changes re-cull every instance
+    _settingFunctions[_lighthouse2Tokens->instanceCulling] = [this](pxr::VtValue const& value)
     {
-        // NOTE: this will be resized as soon as the renderer draws something
-        //       so any value here is fine.
-        ResizeBuffer(1024, 768);
+        _ltCulling.enabled = value.GetWithDefault<bool>(false);
+        _ltCulling.viewChanged = true;
+        return true;
+    };
+    _settingFunctions[_lighthouse2Tokens->cullMinPixelSize] = [this](pxr::VtValue const& value)
+    {
+        _ltCulling.minPixelSize = value.GetWithDefault<float>(1.0f);
+        _ltCulling.viewChanged = _ltCulling.enabled;
+        return true;
+    };
+    _settingFunctions[_lighthouse2Tokens->cullMargin] = [this](pxr::VtValue const& value)
+    {
+        _ltCulling.margin = value.GetWithDefault<float>(0.1f);
+        _ltCulling.viewChanged = _ltCulling.enabled;
+        return true;
+    };
+    for (auto const& setting : _settingsMap)
+    {
+        auto found = _settingFunctions.find(setting.first);
+        if (found != _settingFunctions.end())
+            found->second(setting.second);
     }
 
-    _renderThread.SetRenderCallback(std::bind(_RenderCallback, _ltRenderer, _ltShader, _ltRenderTarget, &_renderThread));
+    _renderThread.SetRenderCallback(std::bind(&HdLighthouse2RenderDelegate::_RenderLoop, this));
     _renderThread.StartThread();
 
     std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
     if (_counterResourceRegistry.fetch_add(1) == 0) {
         _resourceRegistry = std::make_shared<HdResourceRegistry>();
+        _topologyRegistry = std::make_shared<pxr::HdInstanceRegistry<HdLighthouse2TopologySharedPtr>>();
     }
 
 }
@@ -136,10 +177,66 @@ HdLighthouse2RenderDelegate::~HdLighthouse2RenderDelegate()
         std::lock_guard<std::mutex> guard(_mutexResourceRegistry);
         if (_counterResourceRegistry.fetch_sub(1) == 1) {
             _resourceRegistry.reset();
+            _topologyRegistry.reset();
         }
     }
 
     _renderThread.StopThread();
+
+    // drop updates that were never applied
+    for (SceneUpdate* update = _sceneUpdates.PopAll(); update != nullptr;)
+    {
+        SceneUpdate* next = update->next;
+        delete update;
+        update = next;
+    }
+
+    {
+        std::lock_guard<std::mutex> sceneGuard(_ltSceneMutex);
+
+        // the scene pools outlive the renderer: take our nodes out and hand
+        // our meshes and materials over to the free lists for the next
+        // delegate (meshes and materials never added to the scene are deleted)
+        std::unordered_set<HostMesh*> hostMeshes;
+        for (auto const& meshes : { &_ltMeshes, &_ltLights })
+        {
+            for (auto& mesh : *meshes)
+            {
+                _RemoveInstances(mesh);
+                hostMeshes.insert(mesh.mesh);
+            }
+        }
+        for (HostMesh* hostMesh : hostMeshes)
+        {
+            _ReleaseHostMesh(hostMesh);
+        }
+        for (auto const& material : _ltMaterials)
+        {
+            if (material.material->ID == -1)
+                delete material.material;
+            else
+                _ltFreeMaterials.push_back(material.material);
+        }
+
+        if (_ltOwnsScene)
+        {
+            _ltRenderer->Shutdown();
+            delete _ltRenderer;
+            _ltRenderer = nullptr;
+            delete _ltShader;
+            _ltShader = nullptr;
+            _ltSceneOwner = nullptr;
+        }
+    }
+
+    _DiscardReadbacks();
+    for (Readback& readback : _ltReadbacks)
+    {
+        if (readback.buffer)
+            glDeleteBuffers(1, &readback.buffer);
+    }
+    delete _ltRenderTarget;
+    delete _ltDisplayTarget;
 }
 
 
@@ -152,10 +249,31 @@ pxr::HdResourceRegistrySharedPtr HdLighthouse2RenderDelegate::GetResourceRegistr
 void HdLighthouse2RenderDelegate::CommitResources(pxr::HdChangeTracker* /* tracker */)
 {
     _resourceRegistry->Commit();
+
+    // drop topologies no mesh refers to anymore, other delegates may be syncing
+    std::unique_lock<std::shared_mutex> lock(_topologyRegistryMutex);
+    _topologyRegistry->GarbageCollect();
 }
 
 void HdLighthouse2RenderDelegate::SetRenderSetting(pxr::TfToken const& key, pxr::VtValue const& value)
 {
+    std::lock_guard<std::mutex> guard(_rendererMutex);
+
+    _settingsMap[key] = value;
+    _settingsVersion++;
+
+    auto found = _settingFunctions.find(key);
+    if (found != _settingFunctions.end())
+        found->second(value);
+}
+
+pxr::HdRenderSettingDescriptorList HdLighthouse2RenderDelegate::GetRenderSettingDescriptors() const
+{
+    pxr::HdRenderSettingDescriptorList descriptors;
+    descriptors.push_back({ "Instance culling", _lighthouse2Tokens->instanceCulling, pxr::VtValue(false) });
+    descriptors.push_back({ "Cull instances smaller than (pixels)", _lighthouse2Tokens->cullMinPixelSize, pxr::VtValue(1.0f) });
+    descriptors.push_back({ "Culling margin", _lighthouse2Tokens->cullMargin, pxr::VtValue(0.1f) });
+    return descriptors;
 }
 
 pxr::VtValue HdLighthouse2RenderDelegate::GetRenderSetting(pxr::TfToken const& key) const
@@ -163,6 +281,42 @@ pxr::VtValue HdLighthouse2RenderDelegate::GetRenderSetting(pxr::TfToken const& k
     return HdRenderDelegate::GetRenderSetting(key);
 }
 
+pxr::VtDictionary HdLighthouse2RenderDelegate::GetRenderStats() const
+{
+    std::lock_guard<std::mutex> guard(_rendererMutex);
+
+    // host-side memory still held by the delegate, staging is expected
+    // to go back to zero once UpdateScene has uploaded everything.
+    size_t stagingBytes = 0;
+    size_t hostMeshBytes = 0;
+    for (auto const& meshes : { &_ltMeshes, &_ltLights })
+    {
+        for (auto const& mesh : *meshes)
+        {
+            stagingBytes += mesh.GetStagingMemoryUsage()
+                + mesh.transforms.capacity() * sizeof(mat4)
+                + mesh.newTransforms.capacity() * sizeof(mat4)
+                + mesh.changedInstances.capacity() * sizeof(int)
+                + mesh.changedTransforms.capacity() * sizeof(mat4)
+                + mesh.attributes.capacity() * sizeof(Lighthouse2Utils::InstanceAttributes)
+                + mesh.instanceIDs.capacity() * sizeof(int);
+            hostMeshBytes += mesh.mesh->triangles.capacity() * sizeof(HostTri)
+                + mesh.mesh->vertices.capacity() * sizeof(float4);
+        }
+    }
+
+    pxr::VtDictionary stats;
+    stats["lighthouse2:meshCount"] = pxr::VtValue(_ltMeshes.Size());
+    stats["lighthouse2:materialCount"] = pxr::VtValue(_ltMaterials.Size());
+    // the free lists belong to the scene owner, its render thread uses them
+    // under its renderer mutex
+    stats["lighthouse2:freeHostMeshes"] = pxr::VtValue(_ltOwnsScene ? _ltFreeHostMeshes.size() : size_t(0));
+    stats["lighthouse2:freeMaterials"] = pxr::VtValue(_ltOwnsScene ? _ltFreeMaterials.size() : size_t(0));
+    stats["lighthouse2:stagingMemory"] = pxr::VtValue(stagingBytes);
+    stats["lighthouse2:hostMeshMemory"] = pxr::VtValue(hostMeshBytes);
+    return stats;
+}
+
 pxr::HdRenderPassSharedPtr HdLighthouse2RenderDelegate::CreateRenderPass(
     pxr::HdRenderIndex* index,
     pxr::HdRprimCollection const& collection)
@@ -252,6 +406,7 @@ pxr::HdBprim* HdLighthouse2RenderDelegate::CreateFallbackBprim(pxr::TfToken cons
 
 void HdLighthouse2RenderDelegate::DestroyBprim(pxr::HdBprim* bPrim)
 {
+    delete bPrim;
 }
 
 pxr::HdInstancer* HdLighthouse2RenderDelegate::CreateInstancer(pxr::HdSceneDelegate* delegate, pxr::SdfPath const& id)
@@ -275,23 +430,287 @@ pxr::HdAovDescriptor HdLighthouse2RenderDelegate::GetDefaultAovDescriptor(pxr::T
     {
         return pxr::HdAovDescriptor(pxr::HdFormatFloat16Vec4, false, pxr::VtValue(pxr::GfVec4f(0.0f)));
     }
+    else if (name == pxr::HdAovTokens->depth)
+    {
+        return pxr::HdAovDescriptor(pxr::HdFormatFloat32, false, pxr::VtValue(1.0f));
+    }
+    else if (name == pxr::HdAovTokens->normal)
+    {
+        return pxr::HdAovDescriptor(pxr::HdFormatFloat32Vec3, false, pxr::VtValue(pxr::GfVec3f(0.0f)));
+    }
+    else if (name == pxr::HdAovTokens->primId || name == pxr::HdAovTokens->instanceId)
+    {
+        return pxr::HdAovDescriptor(pxr::HdFormatInt32, false, pxr::VtValue(-1));
+    }
 
     return pxr::HdAovDescriptor(pxr::HdFormatInvalid, false, pxr::VtValue());
 }
 
+// Queued by the prim destructors, so it runs after their last updates.
+struct HdLighthouse2RenderDelegate::_RemovalUpdate final : public SceneUpdate
+{
+    enum Kind { Mesh, Light, Material };
+    Kind kind;
+    HdLighthouse2Handle handle;
+
+    _RemovalUpdate(Kind i_kind, HdLighthouse2Handle i_handle) : kind(i_kind), handle(i_handle) {}
+
+    virtual void Apply(HdLighthouse2RenderDelegate& i_delegate) override
+    {
+        switch (kind)
+        {
+        case Mesh:
+            i_delegate._RemoveMesh(i_delegate._ltMeshes, handle, true);
+            break;
+        case Light:
+            // the light material belongs to the light prim, released with DestroyMaterial
+            i_delegate._RemoveMesh(i_delegate._ltLights, handle, false);
+            break;
+        case Material:
+            i_delegate.ReleaseMaterialHandle(handle);
+            break;
+        }
+    }
+};
+
+void HdLighthouse2RenderDelegate::DestroyMesh(HdLighthouse2Handle i_handle)
+{
+    EnqueueSceneUpdate(std::unique_ptr<SceneUpdate>(new _RemovalUpdate(_RemovalUpdate::Mesh, i_handle)));
+}
+
+void HdLighthouse2RenderDelegate::DestroyLight(HdLighthouse2Handle i_handle)
+{
+    EnqueueSceneUpdate(std::unique_ptr<SceneUpdate>(new _RemovalUpdate(_RemovalUpdate::Light, i_handle)));
+}
+
+void HdLighthouse2RenderDelegate::DestroyMaterial(HdLighthouse2Handle i_handle)
+{
+    EnqueueSceneUpdate(std::unique_ptr<SceneUpdate>(new _RemovalUpdate(_RemovalUpdate::Material, i_handle)));
+}
+
+void HdLighthouse2RenderDelegate::_ApplySceneUpdates()
+{
+    for (SceneUpdate* update = _sceneUpdates.PopAll(); update != nullptr;)
+    {
+        SceneUpdate* next = update->next;
+        update->Apply(*this);
+        delete update;
+        update = next;
+    }
+}
+
+void HdLighthouse2RenderDelegate::_RenderLoop()
+{
+    // the render pass only (re)starts the thread after a camera, size or
+    // AOV change, the first pass always starts over
+    bool restart = true;
+    {
+        // nothing published by an earlier run may be presented: the camera,
+        // size or AOVs changed, and the target is about to be written
+        std::lock_guard<std::mutex> guard(_frameMutex);
+        _frameReady = false;
+        _frameGeneration++;
+    }
+
+    while (!_renderThread.IsStopRequested())
+    {
+        if (_renderThread.IsPauseRequested())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        // swap point: apply what Sync queued while the last pass rendered
+        restart = UpdateScene() || restart;
+
+        _ltRenderer->SynchronizeSceneData();
+        _ltRenderer->Render(restart ? lighthouse2::Convergence::Restart : lighthouse2::Convergence::Converge);
+        _ltRenderer->WaitForRender();
+        restart = false;
+
+        // publish the pass, the next one would overwrite the render target
+        // so wait for PresentFrame to take it (or for a stop request)
+        std::unique_lock<std::mutex> lock(_frameMutex);
+        _frameReady = true;
+        while (_frameReady && !_renderThread.IsStopRequested())
+        {
+            _frameConsumed.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+    // stopped before PresentFrame took the last pass, drop it
+    std::lock_guard<std::mutex> guard(_frameMutex);
+    _frameReady = false;
+}
+
+void HdLighthouse2RenderDelegate::ResizeBuffer(int width, int height)
+{
+    if( _ltRenderTarget )
+        delete _ltRenderTarget;
+    if( _ltDisplayTarget )
+        delete _ltDisplayTarget;
+    _ltRenderTarget = new GLTexture(width, height, GLTexture::FLOAT);
+    _ltDisplayTarget = new GLTexture(width, height, GLTexture::FLOAT);
+    if (_ltOwnsScene)
+        _ltRenderer->SetTarget(_ltRenderTarget, 1);
+    _frameReady = false;
+    _hasDisplayFrame = false;
+    _DiscardReadbacks();
+    _ltFramePixels.clear();
+}
+
+bool HdLighthouse2RenderDelegate::PresentFrame(bool i_readback)
+{
+    bool presented = false;
+    {
+        std::lock_guard<std::mutex> guard(_frameMutex);
+        if (_readbackGeneration != _frameGeneration)
+        {
+            // copies still in flight belong to the previous run
+            _DiscardReadbacks();
+            _readbackGeneration = _frameGeneration;
+        }
+        if (_frameReady)
+        {
+            // the render thread is waiting, the target is not being written;
+            // both copies are queued on the GPU, the thread resumes at once
+            if (i_readback)
+            {
+                _StartReadback();
+            }
+            else
+            {
+                glCopyImageSubData(
+                    _ltRenderTarget->ID, GL_TEXTURE_2D, 0, 0, 0, 0,
+                    _ltDisplayTarget->ID, GL_TEXTURE_2D, 0, 0, 0, 0,
+                    _ltRenderTarget->width, _ltRenderTarget->height, 1);
+                _hasDisplayFrame = true;
+                presented = true;
+            }
+            _frameReady = false;
+        }
+    }
+    _frameConsumed.notify_one();
+
+    if (i_readback)
+    {
+        presented = _FinishReadbacks();
+    }
+    return presented;
+}
+
+void HdLighthouse2RenderDelegate::_StartReadback()
+{
+    Readback& readback = _ltReadbacks[_ltNextReadback];
+    _ltNextReadback = (_ltNextReadback + 1) % READBACK_RING_SIZE;
+
+    // ring full: the oldest copy is still pending, a newer one replaces it
+    if (readback.fence)
+    {
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+    }
+
+    const int width = _ltRenderTarget->width;
+    const int height = _ltRenderTarget->height;
+    if (!readback.buffer)
+    {
+        glGenBuffers(1, &readback.buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    if (readback.width != width || readback.height != height)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width) * height * sizeof(float4), nullptr, GL_STREAM_READ);
+        readback.width = width;
+        readback.height = height;
+    }
+
+    // with a pack buffer bound this only queues the copy
+    glBindTexture(GL_TEXTURE_2D, _ltRenderTarget->ID);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.frame = ++_ltReadbackFrame;
+    glFlush();
+}
+
+bool HdLighthouse2RenderDelegate::_FinishReadbacks()
+{
+    // the newest copy that completed, older ones are stale once it did
+    Readback* newest = nullptr;
+    for (Readback& readback : _ltReadbacks)
+    {
+        if (!readback.fence || (newest && newest->frame > readback.frame))
+            continue;
+        const GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            newest = &readback;
+    }
+    if (!newest)
+        return false;
+
+    for (Readback& readback : _ltReadbacks)
+    {
+        if (readback.fence && readback.frame <= newest->frame)
+        {
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+        }
+    }
+
+    const size_t size = size_t(newest->width) * newest->height;
+    _ltFramePixels.resize(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, newest->buffer);
+    if (const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size * sizeof(float4), GL_MAP_READ_BIT))
+    {
+        memcpy(_ltFramePixels.data(), pixels, size * sizeof(float4));
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+
+void HdLighthouse2RenderDelegate::_DiscardReadbacks()
+{
+    for (Readback& readback : _ltReadbacks)
+    {
+        if (readback.fence)
+        {
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+        }
+    }
+}
+
 bool HdLighthouse2RenderDelegate::UpdateScene()
 {
-    bool result = false;
+    // every change goes through the queue: nothing queued, nothing to do
+    // (unless instances have to be culled again)
+    if (_sceneUpdates.Empty() && !_ltCulling.viewChanged)
+    {
+        return false;
+    }
+
+    // Sync no longer touches the scene, it only queues its converted data.
+    std::lock_guard<std::mutex> guard(_rendererMutex);
+
+    // fills the dirty lists, material or sky changes don't dirty any mesh
+    // but still need a new frame
+    _ApplySceneUpdates();
 
     // check for new materials before checking for meshes
     //
-    for (auto it = _ltMaterials.begin(); it != _ltMaterials.end(); ++it)
+    for (auto const& handle : _ltNewMaterials)
     {
-        if (it->second.material->ID == -1)
+        Lighthouse2Material* material = _ltMaterials.Find(handle);
+        if (material != nullptr && material->material->ID == -1)
         {
-            it->second.material->ID = _ltRenderer->GetScene()->AddMaterial(it->second.material);
+            _AddSceneMaterial(*material);
         }
     }
+    _ltNewMaterials.clear();
 
     // set skydome
     // 
@@ -310,170 +729,624 @@ bool HdLighthouse2RenderDelegate::UpdateScene()
     //    _ltRenderer->GetScene()->sky->worldToLight = mat4::RotateX(-PI / 2); // compensate for different evaluation in PBRT
     //}
 
-    // check for new meshes
+    // changed meshes only
     //
-    for (auto it = _ltMeshes.begin(); it != _ltMeshes.end(); ++it)
+    for (auto const& handle : _ltDirtyMeshes)
     {
-        if (it->second.dirtyMesh || it->second.dirtyTransform)
+        Lighthouse2Mesh* mesh = _ltMeshes.Find(handle);
+        if (mesh != nullptr)
         {
-            result = true;
+            _UpdateMesh(*mesh, true);
         }
+    }
+    _ltDirtyMeshes.clear();
 
-        if (it->second.mesh->ID != -1 && it->second.dirtyMesh)
+    // changed lights only
+    //
+    for (auto const& handle : _ltDirtyLights)
+    {
+        Lighthouse2Mesh* light = _ltLights.Find(handle);
+        if (light != nullptr)
         {
-            it->second.dirtyMesh = false;
+            _UpdateMesh(*light, false);
         }
+    }
+    _ltDirtyLights.clear();
 
+    // one bulk write for every moved instance, before re-culling removes
+    // any node. The buffers keep their capacity for the next frame.
+    if (!_ltPendingNodeIDs.empty())
+    {
+        Lighthouse2Utils::SetNodeTransforms(_ltRenderer->GetScene(), _ltPendingNodeIDs, _ltPendingNodeTransforms);
+        _ltPendingNodeIDs.clear();
+        _ltPendingNodeTransforms.clear();
+    }
 
-        if (it->second.mesh->ID == -1)
+    // camera or culling settings changed, re-cull every instanced mesh
+    if (_ltCulling.viewChanged.exchange(false))
+    {
+        for (auto& mesh : _ltMeshes)
         {
-            it->second.dirtyMesh = false;
-
-            //std::cout << "Building mesh for " << it->first << std::endl;
-            _ltRenderer->GetScene()->AddMesh(it->second.mesh);
-            
-            auto matId = _ltDefaultMaterial;
-            if (_ltMeshToMaterialMap.find(it->first) != _ltMeshToMaterialMap.end())
+            if (mesh.instanced && mesh.mesh->ID != -1)
             {
-                auto& matPath = _ltMeshToMaterialMap[it->first];
-                if (_ltMaterials.find(matPath) != _ltMaterials.end())
-                {
-                    matId = _ltMaterials[matPath].material->ID;
-                }
+                mesh.newTransforms = mesh.transforms;
+                _DiffInstances(mesh);
             }
+        }
+    }
 
-            if (it->second.st.size() == 0)
-            {
-                it->second.mesh->BuildFromIndexedData(
-                    it->second.indices,
-                    it->second.vertices,
-                    it->second.normals,
-                    it->second.uvs,
-                    it->second.uvs2,
-                    it->second.t,
-                    it->second.poses,
-                    it->second.joints,
-                    it->second.weights,
-                    matId
-                );
-            }
-            // Add facevarying primvars
-            else
-            {
-                Lighthouse2Utils::BuildFromIndexedData(
-                    it->second.mesh,
-                    it->second.indices,
-                    it->second.vertices,
-                    it->second.normals,
-                    it->second.st,
-                    matId
-                );
-            }
-            //it->second.mesh->BuildMaterialList();
-            it->second.instanceIDs.resize(it->second.transforms.size());
-            for (int i = 0; i < it->second.transforms.size(); ++i)
-                it->second.instanceIDs[i] = _ltRenderer->AddInstance(it->second.mesh->ID, it->second.transforms[i]);
+    //static float r = 0;
+    //mat4 M = mat4::RotateY(r * 2.0f) * mat4::RotateZ(0.2f * sinf(r * 8.0f)) * mat4::Translate(make_float3(0, 5, 0));
+    //_ltRenderer->SetNodeTransform(_ltCar, M);
+    //if ((r += 0.025f * 0.3f) > 2 * PI) r -= 2 * PI;
+
+    return true;
+}
+
+void HdLighthouse2RenderDelegate::_UpdateMesh(Lighthouse2Mesh& i_mesh, bool i_share)
+{
+    i_mesh.queued = false;
+    const bool geometryChanged = i_mesh.dirtyMesh;
+
+    if (i_share && i_mesh.dirtyMesh && _ShareMesh(i_mesh))
+    {
+        // same content as an existing mesh, instanced it
+    }
+    else
+    {
+        if (i_mesh.mesh->ID != -1 && i_mesh.dirtyMesh)
+        {
+            // deforming mesh, update the existing geometry
+            _RefitMesh(i_mesh);
         }
-        
-        if (it->second.dirtyTransform)
+
+        if (i_mesh.mesh->ID == -1)
         {
-            it->second.dirtyTransform = false;
-            for (int i = 0; i < it->second.transforms.size(); ++i)
-                _ltRenderer->SetNodeTransform(it->second.instanceIDs[i], it->second.transforms[i]);
+            _BuildMesh(i_mesh);
         }
     }
 
-    // check for new lights
-    //
-    for (auto it = _ltLights.begin(); it != _ltLights.end(); ++it)
+    if (i_mesh.dirtyTransform)
     {
-        if (it->second.dirtyMesh || it->second.dirtyTransform)
+        i_mesh.dirtyTransform = false;
+        _DiffInstances(i_mesh);
+    }
+    else if (geometryChanged && _ltCulling.enabled && i_mesh.instanced)
+    {
+        // (re)built or (un)shared meshes get all their instances back
+        i_mesh.newTransforms = i_mesh.transforms;
+        _DiffInstances(i_mesh);
+    }
+
+    if (!i_mesh.changedInstances.empty())
+    {
+        _PatchInstances(i_mesh);
+    }
+}
+
+void HdLighthouse2RenderDelegate::_AddSceneMaterial(Lighthouse2Material& io_material)
+{
+    if (!_ltFreeMaterials.empty())
+    {
+        // lighthouse2 can't remove materials, reuse a released scene one
+        HostMaterial* recycled = _ltFreeMaterials.back();
+        _ltFreeMaterials.pop_back();
+        const int id = recycled->ID;
+        *recycled = *io_material.material;
+        recycled->ID = id;
+        recycled->MarkAsDirty();
+        delete io_material.material;
+        io_material.material = recycled;
+    }
+    else
+    {
+        io_material.material->ID = _ltRenderer->GetScene()->AddMaterial(io_material.material);
+    }
+}
+
+int HdLighthouse2RenderDelegate::_GetMaterialIdForMesh(const Lighthouse2Mesh& i_mesh)
+{
+    auto matId = _ltDefaultMaterial;
+    if (Lighthouse2Material* material = _ltMaterials.Find(i_mesh.material))
+    {
+        matId = material->material->ID;
+    }
+    return matId;
+}
+
+void HdLighthouse2RenderDelegate::_BuildTriangles(Lighthouse2Mesh& i_mesh)
+{
+    // not provided by Hydra, always empty
+    static const std::vector<float2> noUvs2;
+    static const std::vector<float4> noTangents;
+    static const std::vector<HostMesh::Pose> noPoses;
+    static const std::vector<uint4> noJoints;
+    static const std::vector<float4> noWeights;
+
+    auto matId = _GetMaterialIdForMesh(i_mesh);
+    i_mesh.hasUvs = i_mesh.st.size() > 0 || i_mesh.uvs.size() > 0;
+
+    if (i_mesh.st.size() == 0)
+    {
+        i_mesh.mesh->BuildFromIndexedData(
+            i_mesh.indices,
+            i_mesh.vertices,
+            i_mesh.normals,
+            i_mesh.uvs,
+            noUvs2,
+            noTangents,
+            noPoses,
+            noJoints,
+            noWeights,
+            matId
+        );
+    }
+    // Add facevarying primvars
+    else
+    {
+        Lighthouse2Utils::BuildFromIndexedData(
+            i_mesh.mesh,
+            i_mesh.indices,
+            i_mesh.vertices,
+            i_mesh.normals,
+            i_mesh.st,
+            matId
+        );
+    }
+}
+
+void HdLighthouse2RenderDelegate::_BuildMesh(Lighthouse2Mesh& i_mesh)
+{
+    i_mesh.dirtyMesh = false;
+    i_mesh.dirtyTopology = false;
+
+    // never added yet, take a released scene mesh if there is one
+    delete i_mesh.mesh;
+    i_mesh.mesh = _AcquireSceneMesh();
+    if (i_mesh.sharedHash != 0)
+    {
+        // registered as the prototype of its content before being built
+        auto found = _ltSharedGeometry.find(i_mesh.sharedHash);
+        if (found != _ltSharedGeometry.end())
+            found->second.mesh = i_mesh.mesh;
+    }
+    _BuildTriangles(i_mesh);
+    if (i_mesh.sharedHash != 0)
+    {
+        auto found = _ltSharedGeometry.find(i_mesh.sharedHash);
+        if (found != _ltSharedGeometry.end())
+            found->second.hasUvs = i_mesh.hasUvs;
+    }
+    i_mesh.mesh->MarkAsDirty();
+    //i_mesh.mesh->BuildMaterialList();
+
+    _AddInstances(i_mesh);
+
+    i_mesh.ReleaseStaging();
+}
+
+void HdLighthouse2RenderDelegate::_RefitMesh(Lighthouse2Mesh& i_mesh)
+{
+    i_mesh.dirtyMesh = false;
+
+    if (i_mesh.dirtyTopology || i_mesh.indices.size() != i_mesh.mesh->triangles.size() * 3)
+    {
+        // new triangles or uvs, rebuild them but keep the mesh ID
+        // and its instances.
+        i_mesh.dirtyTopology = false;
+        i_mesh.mesh->triangles.clear();
+        i_mesh.mesh->vertices.clear();
+        _BuildTriangles(i_mesh);
+        i_mesh.mesh->MarkAsDirty();
+    }
+    else
+    {
+        Lighthouse2Utils::RefitFromIndexedData(
+            i_mesh.mesh,
+            i_mesh.indices,
+            i_mesh.vertices,
+            i_mesh.normals,
+            i_mesh.hasUvs);
+    }
+
+    for (int i = 0; i < i_mesh.instanceIDs.size(); ++i)
+    {
+        if (i_mesh.instanceIDs[i] >= 0)
+            _ltRenderer->GetScene()->nodePool[i_mesh.instanceIDs[i]]->treeChanged = true;
+    }
+
+    i_mesh.ReleaseStaging();
+}
+
+void HdLighthouse2RenderDelegate::_RemoveInstances(Lighthouse2Mesh& i_mesh)
+{
+    for (int i = 0; i < i_mesh.instanceIDs.size(); ++i)
+    {
+        if (i_mesh.instanceIDs[i] >= 0)
+            _RemoveNode(i_mesh.instanceIDs[i]);
+    }
+    i_mesh.instanceIDs.clear();
+}
+
+void HdLighthouse2RenderDelegate::_RemoveMesh(Lighthouse2Utils::SlotMap<Lighthouse2Mesh>& i_meshes, HdLighthouse2Handle i_handle, bool i_releaseMaterial)
+{
+    Lighthouse2Mesh* mesh = i_meshes.Find(i_handle);
+    if (mesh == nullptr)
+    {
+        return;
+    }
+
+    _RemoveInstances(*mesh);
+
+    HostMesh* hostMesh = mesh->mesh;
+    if (mesh->sharedHash != 0)
+    {
+        auto found = _ltSharedGeometry.find(mesh->sharedHash);
+        if (found != _ltSharedGeometry.end() && --found->second.refCount > 0)
         {
-            result = true;
+            // still instanced by other meshes
+            hostMesh = nullptr;
         }
-
-        if (it->second.mesh->ID != -1 && it->second.dirtyMesh)
+        else if (found != _ltSharedGeometry.end())
         {
-            it->second.dirtyMesh = false;
-            Lighthouse2Utils::UpdateVertices(
-                it->second.mesh,
-                it->second.indices,
-                it->second.vertices );
-            //_ltRenderer->GetScene()->nodePool[it->second.mesh->ID]->PrepareLights();
-            //_ltRenderer->GetScene()->nodePool[it->second.mesh->ID]->UpdateLights();
-            _ltRenderer->GetScene()->nodePool[it->second.mesh->ID]->treeChanged = true;
-            // dirty mesh, delete and recreate
-            // TODO: figure out if we can update vertices in Lighthouse2
-            //for (int i = 0; i < it->second.instanceIDs.size(); ++i)
-            //    _ltRenderer->GetScene()->RemoveNode(it->second.instanceIDs[i]);
-            //it->second.instanceIDs.resize(it->second.transforms.size());
-            //for (int i = 0; i < it->second.transforms.size(); ++i)
-            //    it->second.instanceIDs[i] = _ltRenderer->AddInstance(it->second.mesh->ID, it->second.transforms[i]);
-            //it->second.mesh->ID = -1;
+            _EraseSharedGeometry(found);
         }
+    }
+    if (hostMesh != nullptr)
+    {
+        _ReleaseHostMesh(hostMesh);
+    }
+
+    if (i_releaseMaterial)
+    {
+        ReleaseMaterialHandle(mesh->material);
+    }
+    i_meshes.Remove(i_handle);
+}
 
+HostMesh* HdLighthouse2RenderDelegate::_AcquireSceneMesh()
+{
+    if (!_ltFreeHostMeshes.empty())
+    {
+        HostMesh* mesh = _ltFreeHostMeshes.back();
+        _ltFreeHostMeshes.pop_back();
+        return mesh;
+    }
+    HostMesh* mesh = new HostMesh();
+    _ltRenderer->GetScene()->AddMesh(mesh);
+    return mesh;
+}
 
-        if (it->second.mesh->ID == -1)
-        {
-            it->second.dirtyMesh = false;
-            _ltRenderer->GetScene()->AddMesh(it->second.mesh);
+void HdLighthouse2RenderDelegate::_ReleaseHostMesh(HostMesh* i_mesh)
+{
+    if (i_mesh->ID == -1)
+    {
+        delete i_mesh;
+        return;
+    }
 
-            auto matId = _ltDefaultMaterial;
-            if (_ltMeshToMaterialMap.find(it->first) != _ltMeshToMaterialMap.end())
+    // can't be removed from the scene, release its triangles until reused
+    std::vector<HostTri>().swap(i_mesh->triangles);
+    std::vector<float4>().swap(i_mesh->vertices);
+    i_mesh->MarkAsDirty();
+    _ltFreeHostMeshes.push_back(i_mesh);
+}
+
+void HdLighthouse2RenderDelegate::ReleaseMaterialHandle(HdLighthouse2Handle i_handle)
+{
+    Lighthouse2Material* material = _ltMaterials.Find(i_handle);
+    if (material == nullptr || --material->refCount > 0)
+    {
+        return;
+    }
+
+    _ltMaterialHandles.erase(material->path);
+    HostMaterial* hostMaterial = material->material;
+    if (hostMaterial->ID == -1)
+    {
+        delete hostMaterial;
+    }
+    else if (hostMaterial->ID != _ltDefaultMaterial)
+    {
+        _ltFreeMaterials.push_back(hostMaterial);
+    }
+    _ltMaterials.Remove(i_handle);
+}
+
+void HdLighthouse2RenderDelegate::_AddInstances(Lighthouse2Mesh& i_mesh)
+{
+    i_mesh.instanceIDs.resize(i_mesh.transforms.size());
+    for (int i = 0; i < i_mesh.transforms.size(); ++i)
+    {
+        i_mesh.instanceIDs[i] = _ltRenderer->AddInstance(i_mesh.mesh->ID, i_mesh.transforms[i]);
+        _SetInstanceAttributes(i_mesh.instanceIDs[i], i_mesh, i);
+    }
+}
+
+void HdLighthouse2RenderDelegate::_RemoveNode(int i_nodeID)
+{
+    _ltRenderer->GetScene()->RemoveNode(i_nodeID);
+    // node IDs are recycled, the next instance must not inherit these
+    if (i_nodeID < (int)_ltInstanceAttributes.size())
+    {
+        _ltInstanceAttributes[i_nodeID] = Lighthouse2Utils::InstanceAttributes();
+    }
+}
+
+void HdLighthouse2RenderDelegate::_SetInstanceAttributes(int i_nodeID, const Lighthouse2Mesh& i_mesh, size_t i_instance)
+{
+    if (i_nodeID >= (int)_ltInstanceAttributes.size())
+    {
+        _ltInstanceAttributes.resize(i_nodeID + 1);
+    }
+    _ltInstanceAttributes[i_nodeID] = i_instance < i_mesh.attributes.size()
+        ? i_mesh.attributes[i_instance]
+        : Lighthouse2Utils::InstanceAttributes();
+}
+
+void HdLighthouse2RenderDelegate::_DiffInstances(Lighthouse2Mesh& i_mesh)
+{
+    // instances are identified by their index, as in the instancer,
+    // culled ones have no node (-1).
+    const bool cull = _ltCulling.enabled && i_mesh.instanced;
+    const size_t oldCount = i_mesh.instanceIDs.size();
+    const size_t newCount = i_mesh.newTransforms.size();
+
+    for (size_t i = newCount; i < oldCount; ++i)
+    {
+        if (i_mesh.instanceIDs[i] >= 0)
+            _RemoveNode(i_mesh.instanceIDs[i]);
+    }
+    i_mesh.instanceIDs.resize(newCount, -1);
+
+    for (size_t i = 0; i < newCount; ++i)
+    {
+        int& nodeID = i_mesh.instanceIDs[i];
+        const bool visible = !cull || _IsInstanceVisible(i_mesh, i_mesh.newTransforms[i], nodeID >= 0);
+        if (nodeID >= 0)
+        {
+            if (!visible)
             {
-                auto& matPath = _ltMeshToMaterialMap[it->first];
-                if (_ltMaterials.find(matPath) != _ltMaterials.end())
-                {
-                    matId = _ltMaterials[matPath].material->ID;
-                }
+                _RemoveNode(nodeID);
+                nodeID = -1;
             }
+            else if (i < oldCount && std::memcmp(i_mesh.transforms[i].cell, i_mesh.newTransforms[i].cell, sizeof(mat4)) != 0)
+            {
+                // only push the matrices that moved, UpdateScene submits them all at once
+                _ltPendingNodeIDs.push_back(nodeID);
+                _ltPendingNodeTransforms.push_back(i_mesh.newTransforms[i]);
+            }
+        }
+        else if (visible)
+        {
+            nodeID = _ltRenderer->AddInstance(i_mesh.mesh->ID, i_mesh.newTransforms[i]);
+        }
+        if (nodeID >= 0)
+        {
+            // attributes may change without the instance moving
+            _SetInstanceAttributes(nodeID, i_mesh, i);
+        }
+    }
+
+    i_mesh.transforms.swap(i_mesh.newTransforms);
+    std::vector<mat4>().swap(i_mesh.newTransforms);
+}
 
-            if (it->second.st.size() == 0)
+void HdLighthouse2RenderDelegate::_PatchInstances(Lighthouse2Mesh& i_mesh)
+{
+    // same as _DiffInstances, restricted to the instances the instancer moved
+    const bool cull = _ltCulling.enabled && i_mesh.instanced;
+    for (size_t k = 0; k < i_mesh.changedInstances.size(); ++k)
+    {
+        const size_t i = (size_t)i_mesh.changedInstances[k];
+        if (i >= i_mesh.transforms.size())
+            continue;
+        const mat4& transform = i_mesh.changedTransforms[k];
+        i_mesh.transforms[i] = transform;
+
+        int& nodeID = i_mesh.instanceIDs[i];
+        const bool visible = !cull || _IsInstanceVisible(i_mesh, transform, nodeID >= 0);
+        if (nodeID >= 0)
+        {
+            if (!visible)
             {
-                it->second.mesh->BuildFromIndexedData(
-                    it->second.indices,
-                    it->second.vertices,
-                    it->second.normals,
-                    it->second.uvs,
-                    it->second.uvs2,
-                    it->second.t,
-                    it->second.poses,
-                    it->second.joints,
-                    it->second.weights,
-                    matId
-                );
+                _RemoveNode(nodeID);
+                nodeID = -1;
             }
-            // Add facevarying primvars
             else
             {
-                Lighthouse2Utils::BuildFromIndexedData(
-                    it->second.mesh,
-                    it->second.indices,
-                    it->second.vertices,
-                    it->second.normals,
-                    it->second.st,
-                    matId
-                );
+                _ltPendingNodeIDs.push_back(nodeID);
+                _ltPendingNodeTransforms.push_back(transform);
             }
-            it->second.instanceIDs.resize(it->second.transforms.size());
-            for (int i = 0; i < it->second.transforms.size(); ++i)
-                it->second.instanceIDs[i] = _ltRenderer->AddInstance(it->second.mesh->ID, it->second.transforms[i]);
         }
+        else if (visible)
+        {
+            nodeID = _ltRenderer->AddInstance(i_mesh.mesh->ID, transform);
+        }
+        if (nodeID >= 0)
+        {
+            _SetInstanceAttributes(nodeID, i_mesh, i);
+        }
+    }
 
-        if (it->second.dirtyTransform)
+    i_mesh.changedInstances.clear();
+    i_mesh.changedTransforms.clear();
+    i_mesh.changedSlots.clear();
+}
+
+bool HdLighthouse2RenderDelegate::_IsInstanceVisible(const Lighthouse2Mesh& i_mesh, const mat4& i_transform, bool i_wasVisible) const
+{
+    const float* m = i_transform.cell;
+    const float3 c = i_mesh.boundsCenter;
+    const float3 center = make_float3(
+        m[0] * c.x + m[1] * c.y + m[2] * c.z + m[3],
+        m[4] * c.x + m[5] * c.y + m[6] * c.z + m[7],
+        m[8] * c.x + m[9] * c.y + m[10] * c.z + m[11]);
+    const float scale = std::sqrt(std::max({
+        m[0] * m[0] + m[4] * m[4] + m[8] * m[8],
+        m[1] * m[1] + m[5] * m[5] + m[9] * m[9],
+        m[2] * m[2] + m[6] * m[6] + m[10] * m[10] }));
+    const float radius = i_mesh.boundsRadius * scale;
+
+    // frustum, instances already in the scene get a larger sphere
+    const float grow = i_wasVisible ? 1.0f + _ltCulling.margin : 1.0f;
+    for (const float4& plane : _ltCulling.planes)
+    {
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius * grow)
+            return false;
+    }
+
+    // projected size, never culled when the camera is inside the bounds
+    if (_ltCulling.minPixelSize > 0.0f)
+    {
+        const float w = _ltCulling.orthographic ? 1.0f :
+            _ltCulling.clipW.x * center.x + _ltCulling.clipW.y * center.y + _ltCulling.clipW.z * center.z + _ltCulling.clipW.w;
+        if (_ltCulling.orthographic || w > radius)
         {
-            it->second.dirtyTransform = false;
-            for (int i = 0; i < it->second.transforms.size(); ++i)
-                _ltRenderer->SetNodeTransform(it->second.instanceIDs[i], it->second.transforms[i]);
+            const float pixels = 2.0f * radius * _ltCulling.pixelScale / w;
+            const float shrink = i_wasVisible ? 1.0f - _ltCulling.margin : 1.0f;
+            if (pixels < _ltCulling.minPixelSize * shrink)
+                return false;
         }
     }
+    return true;
+}
 
-    //static float r = 0;
-    //mat4 M = mat4::RotateY(r * 2.0f) * mat4::RotateZ(0.2f * sinf(r * 8.0f)) * mat4::Translate(make_float3(0, 5, 0));
-    //_ltRenderer->SetNodeTransform(_ltCar, M);
-    //if ((r += 0.025f * 0.3f) > 2 * PI) r -= 2 * PI;
+void HdLighthouse2RenderDelegate::SetCullingView(const pxr::GfMatrix4d& i_view, const pxr::GfMatrix4d& i_proj, int i_height)
+{
+    std::lock_guard<std::mutex> guard(_rendererMutex);
+
+    // Hydra matrices are row vector: clip = p * viewProj, a clip
+    // coordinate is a column of viewProj.
+    const pxr::GfMatrix4d viewProj = i_view * i_proj;
+    auto column = [&](int j)
+    {
+        return make_float4((float)viewProj[0][j], (float)viewProj[1][j], (float)viewProj[2][j], (float)viewProj[3][j]);
+    };
+    const float4 x = column(0), y = column(1), z = column(2), w = column(3);
+    const float4 planes[6] = { w + x, w - x, w + y, w - y, w + z, w - z };
+    for (int i = 0; i < 6; ++i)
+    {
+        const float length = std::sqrt(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+        _ltCulling.planes[i] = length > 0.0f ? planes[i] * (1.0f / length) : planes[i];
+    }
+    _ltCulling.clipW = w;
+    _ltCulling.orthographic = i_proj[3][3] == 1.0;
+    _ltCulling.pixelScale = (float)i_proj[1][1] * 0.5f * (float)i_height;
+    _ltCulling.viewChanged = _ltCulling.enabled;
+}
+
+void HdLighthouse2RenderDelegate::_UnshareMesh(Lighthouse2Mesh& i_mesh)
+{
+    auto found = _ltSharedGeometry.find(i_mesh.sharedHash);
+    i_mesh.sharedHash = 0;
+    if (found == _ltSharedGeometry.end())
+    {
+        return;
+    }
+
+    if (--found->second.refCount == 0)
+    {
+        // last user, the HostMesh is all ours again
+        _EraseSharedGeometry(found);
+        return;
+    }
+
+    // still used by others: take a private copy of the triangles, so
+    // this mesh can be refit or rebuilt without touching them.
+    HostMesh* ownMesh = _AcquireSceneMesh();
+    ownMesh->triangles = i_mesh.mesh->triangles;
+    ownMesh->vertices = i_mesh.mesh->vertices;
+    ownMesh->MarkAsDirty();
+
+    _RemoveInstances(i_mesh);
+    i_mesh.mesh = ownMesh;
+    _AddInstances(i_mesh);
+}
+
+// The content hash alone could alias two different meshes: check the
+// staged triangle corners against the prototype's before sharing it.
+static bool _HasSameGeometry(const HdLighthouse2RenderDelegate::Lighthouse2Mesh& i_mesh, const HdLighthouse2RenderDelegate::SharedGeometry& i_shared)
+{
+    const HostMesh* prototype = i_shared.mesh;
+    const bool hasUvs = i_mesh.st.size() > 0 || i_mesh.uvs.size() > 0;
+    if (hasUvs != i_shared.hasUvs || i_mesh.indices.size() != prototype->vertices.size())
+        return false;
+
+    for (size_t i = 0; i < i_mesh.indices.size(); ++i)
+    {
+        const int index = i_mesh.indices[i];
+        if (index < 0 || index >= (int)i_mesh.vertices.size())
+            return false;
+        const float3& v = i_mesh.vertices[index];
+        const float4& p = prototype->vertices[i];
+        if (v.x != p.x || v.y != p.y || v.z != p.z)
+            return false;
+    }
+    return true;
+}
+
+void HdLighthouse2RenderDelegate::_EraseSharedGeometry(std::unordered_map<size_t, SharedGeometry>::iterator i_shared)
+{
+    const HdLighthouse2Handle material = i_shared->second.material;
+    _ltSharedGeometry.erase(i_shared);
+    ReleaseMaterialHandle(material);
+}
+
+bool HdLighthouse2RenderDelegate::_ShareMesh(Lighthouse2Mesh& i_mesh)
+{
+    const size_t hash = i_mesh.geometryHash;
+    if (hash != 0 && hash == i_mesh.sharedHash && i_mesh.mesh->ID != -1)
+    {
+        // content did not change
+        i_mesh.dirtyMesh = false;
+        i_mesh.dirtyTopology = false;
+        i_mesh.ReleaseStaging();
+        return true;
+    }
+
+    // the content changed (or the mesh deforms), leave the current prototype
+    _UnshareMesh(i_mesh);
+
+    if (hash == 0)
+    {
+        return false;
+    }
+
+    auto found = _ltSharedGeometry.find(hash);
+    if (found == _ltSharedGeometry.end())
+    {
+        // first mesh with this content, the caller builds it
+        SharedGeometry shared{ i_mesh.mesh, 1 };
+        if (Lighthouse2Material* material = _ltMaterials.Find(i_mesh.material))
+        {
+            material->refCount++;
+            shared.material = i_mesh.material;
+        }
+        _ltSharedGeometry[hash] = shared;
+        i_mesh.sharedHash = hash;
+        return false;
+    }
+
+    if (!_HasSameGeometry(i_mesh, found->second))
+    {
+        // hash collision, keep this one out of the shared geometry
+        return false;
+    }
 
-    return result;
+    // drop our own geometry and instance the prototype instead
+    _RemoveInstances(i_mesh);
+    _ReleaseHostMesh(i_mesh.mesh);
+
+    found->second.refCount++;
+    i_mesh.mesh = found->second.mesh;
+    i_mesh.sharedHash = hash;
+    i_mesh.hasUvs = found->second.hasUvs;
+    i_mesh.dirtyMesh = false;
+    i_mesh.dirtyTopology = false;
+    _AddInstances(i_mesh);
+    i_mesh.ReleaseStaging();
+    return true;
 }
 
 pxr::TfToken HdLighthouse2RenderDelegate::GetMaterialBindingPurpose() const
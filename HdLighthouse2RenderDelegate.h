@@ -5,15 +5,31 @@
 #include <pxr/imaging/hd/renderDelegate.h>
 #include <pxr/imaging/hd/resourceRegistry.h>
 #include <pxr/imaging/hd/renderThread.h>
+#include <pxr/imaging/hd/instanceRegistry.h>
 #include <pxr/base/tf/staticTokens.h>
+#include <pxr/base/gf/matrix4d.h>
 
 #include "platform.h"
 #include "rendersystem.h"
+#include "Lighthouse2Utils.h"
 
+#include <array>
+#include <atomic>
 #include <map>
+#include <condition_variable>
+#include <shared_mutex>
+#include <unordered_map>
 
 PXR_NAMESPACE_USING_DIRECTIVE
 
+PXR_NAMESPACE_OPEN_SCOPE
+struct HdLighthouse2Topology;
+PXR_NAMESPACE_CLOSE_SCOPE
+using HdLighthouse2TopologySharedPtr = std::shared_ptr<const pxr::HdLighthouse2Topology>;
+
+// stable handle to a delegate mesh, light or material
+using HdLighthouse2Handle = Lighthouse2Utils::SlotHandle;
+
 using UpdateRenderSettingFunction = std::function<bool(pxr::VtValue const& value)>;
 
 class HdLighthouse2RenderDelegate final : public pxr::HdRenderDelegate
@@ -31,7 +47,7 @@ public:
     virtual const pxr::TfTokenVector& GetSupportedBprimTypes() const override;
 
     virtual pxr::HdRenderParam* GetRenderParam() const override;
-    //virtual HdRenderSettingDescriptorList GetRenderSettingDescriptors() const override;
+    virtual pxr::HdRenderSettingDescriptorList GetRenderSettingDescriptors() const override;
 
     virtual pxr::HdAovDescriptor GetDefaultAovDescriptor(pxr::TfToken const& name) const override;
 
@@ -56,6 +72,14 @@ public:
     virtual void CommitResources(pxr::HdChangeTracker* tracker) override;
     virtual void SetRenderSetting(pxr::TfToken const& key, pxr::VtValue const& value) override;
     virtual pxr::VtValue GetRenderSetting(pxr::TfToken const& key) const override;
+    virtual pxr::VtDictionary GetRenderStats() const override;
+
+    // Lighthouse2 keeps its scene pools (nodes, meshes, materials, textures,
+    // sky) in static HostScene members, so a process has a single scene and
+    // only one delegate can render. The first delegate owns the renderer and
+    // scene until it is destroyed; delegates created meanwhile report an
+    // error and render nothing.
+    bool HasScene() const { return _ltOwnsScene; }
 
     RenderAPI* GetRenderer() { return _ltRenderer; }
     GLTexture* GetRenderTarget() { return _ltRenderTarget; }
@@ -64,77 +88,224 @@ public:
     std::mutex& rendererMutex() { return _rendererMutex; }
     std::mutex& primIndexMutex() { return _primIndexMutex; }
 
+    // A prim change converted by Sync without any lock and handed to the
+    // delegate; UpdateScene applies it to the scene on the render thread.
+    struct SceneUpdate {
+        virtual ~SceneUpdate() = default;
+        virtual void Apply(HdLighthouse2RenderDelegate& i_delegate) = 0;
+        SceneUpdate* next = nullptr;
+    };
+
+    // lock-free, callable from any Sync thread
+    void EnqueueSceneUpdate(std::unique_ptr<SceneUpdate> i_update)
+    {
+        // never applied without a scene, the destructor frees the prims' data
+        if (!_ltOwnsScene)
+            return;
+        _sceneUpdates.Push(i_update.release());
+    }
+
+    // Triangulation and adjacency shared by all meshes with the same
+    // topology, in every delegate. Use it with a shared lock on the mutex,
+    // CommitResources garbage collects it under the exclusive one.
+    pxr::HdInstanceRegistry<HdLighthouse2TopologySharedPtr>& GetTopologyRegistry() { return *_topologyRegistry; }
+    std::shared_mutex& GetTopologyRegistryMutex() { return _topologyRegistryMutex; }
+
     struct Lighthouse2Mesh {
         HostMesh* mesh;
+        HdLighthouse2Handle material; // invalid: default material
         bool dirtyMesh = true;
+        bool dirtyTopology = true; // indices or uvs changed, not only points
         bool dirtyTransform = true;
+        bool hasUvs = false; // uvs baked in mesh->triangles
+        bool queued = false; // already in the delegate dirty list
+        bool instanced = false; // prototype of an instancer, can be culled
+        // local bounding sphere, from the last points
+        float3 boundsCenter = make_float3(0, 0, 0);
+        float boundsRadius = 0.0f;
+        // content hash (topology, points, primvars, material) used to share
+        // identical geometry, 0 if this mesh must not be shared (deforming).
+        size_t geometryHash = 0;
+        // hash of the shared prototype mesh points to, 0 if not registered
+        size_t sharedHash = 0;
+        // host-side staging, written by Sync and released by UpdateScene
+        // once the HostMesh has consumed it.
         std::vector<int> indices;
         std::vector<float3> vertices;
         std::vector<float3> normals;
+        // vertex-varying uvs, only staged with dirtyTopology
         std::vector<float2> uvs;
-        std::vector<float2> uvs2;
-        std::vector<float4> t;
-        std::vector<HostMesh::Pose> poses;
-        std::vector<uint4> joints;
-        std::vector<float4> weights;
+        // facevarying primvars, only staged with dirtyTopology
+        std::vector<float2> st;
+        // transforms of the instances in the scene, one per instanceIDs entry
         std::vector<mat4> transforms;
         std::vector<int> instanceIDs;
-        // facevarying primvars
-        std::vector<float2> st;
+        // transforms from the last Sync, diffed against the ones above
+        std::vector<mat4> newTransforms;
+        // instances moved by their instancer alone, index into transforms
+        std::vector<int> changedInstances;
+        std::vector<mat4> changedTransforms;
+        // instance index to its entry above, an instance moved by several
+        // syncs between two passes keeps one entry with its last transform
+        std::unordered_map<int, size_t> changedSlots;
+        // per-instance shading attributes of the latest transforms, empty
+        // if the instancer authors none
+        std::vector<Lighthouse2Utils::InstanceAttributes> attributes;
+
+        size_t GetStagingMemoryUsage() const
+        {
+            return indices.capacity() * sizeof(int)
+                + vertices.capacity() * sizeof(float3)
+                + normals.capacity() * sizeof(float3)
+                + uvs.capacity() * sizeof(float2)
+                + st.capacity() * sizeof(float2);
+        }
+
+        void ReleaseStaging()
+        {
+            std::vector<int>().swap(indices);
+            std::vector<float3>().swap(vertices);
+            std::vector<float3>().swap(normals);
+            std::vector<float2>().swap(uvs);
+            std::vector<float2>().swap(st);
+        }
+    };
+
+    // geometry shared by all meshes with the same content hash
+    struct SharedGeometry {
+        HostMesh* mesh;
+        int refCount;
+        bool hasUvs = false; // of the prototype, restored on the meshes sharing it
+        // material the prototype triangles were built with, referenced
+        // until the geometry is released: the mesh that built it may go first
+        HdLighthouse2Handle material;
     };
 
     struct Lighthouse2Material {
         HostMaterial* material;
+        pxr::SdfPath path; // key in the material handles
+        int refCount = 0; // GetMaterialHandle calls not released yet
     };
 
-    void ResizeBuffer(int width, int height)
+    // call with the render thread stopped, on the GL thread: the core
+    // registers the new target for interop
+    void ResizeBuffer(int width, int height);
+
+    // Meshes and lights are created with their prim and then addressed by
+    // handle only. Call with rendererMutex held.
+    HdLighthouse2Handle CreateMesh()
+    {
+        Lighthouse2Mesh mesh;
+        mesh.mesh = new HostMesh();
+        return _ltMeshes.Insert(std::move(mesh));
+    }
+
+    HdLighthouse2Handle CreateLight()
     {
-        if( _ltRenderTarget )
-            delete _ltRenderTarget;
-        _ltRenderTarget = new GLTexture(width, height, GLTexture::FLOAT);
-        _ltRenderer->SetTarget(_ltRenderTarget, 1);
+        Lighthouse2Mesh light;
+        light.mesh = new HostMesh();
+        return _ltLights.Insert(std::move(light));
     }
 
-    Lighthouse2Mesh& GetMesh(const pxr::SdfPath& i_path)
+    Lighthouse2Mesh& GetMesh(HdLighthouse2Handle i_handle) { return _ltMeshes[i_handle]; }
+    Lighthouse2Mesh& GetLight(HdLighthouse2Handle i_handle) { return _ltLights[i_handle]; }
+
+    // queue a changed mesh/light for the next UpdateScene, once
+    void MarkMeshDirty(HdLighthouse2Handle i_handle, Lighthouse2Mesh& i_mesh)
     {
-        if (_ltMeshes.find(i_path) == _ltMeshes.end())
+        if (!i_mesh.queued)
         {
-            _ltMeshes[i_path].mesh = new HostMesh();
+            i_mesh.queued = true;
+            _ltDirtyMeshes.push_back(i_handle);
         }
-        return _ltMeshes[i_path];
     }
 
-    Lighthouse2Mesh& GetLight(const pxr::SdfPath& i_path)
+    void MarkLightDirty(HdLighthouse2Handle i_handle, Lighthouse2Mesh& i_light)
     {
-        if (_ltLights.find(i_path) == _ltLights.end())
+        if (!i_light.queued)
         {
-            _ltLights[i_path].mesh = new HostMesh();
+            i_light.queued = true;
+            _ltDirtyLights.push_back(i_handle);
         }
-        return _ltLights[i_path];
     }
 
-    void BindMeshToMaterial(const pxr::SdfPath& i_mesh, const pxr::SdfPath& i_material)
+    // default parameters of materials created by the delegate
+    static void InitMaterial(HostMaterial* o_material, float3 i_color)
     {
-        _ltMeshToMaterialMap[i_mesh] = i_material;
+        o_material->pbrtMaterialType = MaterialType::PBRT_DISNEY;
+        o_material->color = i_color;
+        o_material->metallic = HostMaterial::ScalarValue(0.01f);
+        o_material->roughness = HostMaterial::ScalarValue(0.5f);
+        o_material->specular = HostMaterial::ScalarValue(0.01f);
     }
 
-    Lighthouse2Material& GetMaterial(const pxr::SdfPath& i_path, float3 i_color=make_float3(1,1,1))
+    // Materials are shared by path (material prims, meshes bound to them,
+    // meshes and lights using their own path), the path is only looked up
+    // here. Call with rendererMutex held.
+    HdLighthouse2Handle GetMaterialHandle(const pxr::SdfPath& i_path, float3 i_color=make_float3(1,1,1))
     {
-        if (_ltMaterials.find(i_path) == _ltMaterials.end())
+        auto found = _ltMaterialHandles.find(i_path);
+        if (found != _ltMaterialHandles.end())
         {
-            _ltMaterials[i_path].material = new HostMaterial();
-            _ltMaterials[i_path].material->pbrtMaterialType = MaterialType::PBRT_DISNEY;
-            _ltMaterials[i_path].material->color = i_color;
-            //std::cout << "New material " << i_path << " color=" << i_color.x << "," << i_color.y << "," << i_color.z << std::endl;
-            _ltMaterials[i_path].material->metallic = HostMaterial::ScalarValue(0.01f);
-            _ltMaterials[i_path].material->roughness = HostMaterial::ScalarValue(0.5f);
-            _ltMaterials[i_path].material->specular = HostMaterial::ScalarValue(0.01f);
+            _ltMaterials[found->second].refCount++;
+            return found->second;
         }
-        return _ltMaterials[i_path];
+
+        // detached until UpdateScene adds it to the scene, or copies it
+        // into a released scene material
+        Lighthouse2Material material;
+        material.path = i_path;
+        material.refCount = 1;
+        material.material = new HostMaterial();
+        InitMaterial(material.material, i_color);
+        //std::cout << "New material " << i_path << " color=" << i_color.x << "," << i_color.y << "," << i_color.z << std::endl;
+        HdLighthouse2Handle handle = _ltMaterials.Insert(material);
+        _ltMaterialHandles[i_path] = handle;
+        _ltNewMaterials.push_back(handle);
+        return handle;
     }
 
+    // Drop a GetMaterialHandle reference, the last one frees the material
+    // for reuse. Call with rendererMutex held.
+    void ReleaseMaterialHandle(HdLighthouse2Handle i_handle);
+
+    // Prims being deleted queue the removal of their scene data behind their
+    // last updates, UpdateScene frees the slots and scene resources for
+    // reuse. Lock-free, callable from any thread.
+    void DestroyMesh(HdLighthouse2Handle i_handle);
+    void DestroyLight(HdLighthouse2Handle i_handle);
+    // releases the reference taken by a prim, queued like the above
+    void DestroyMaterial(HdLighthouse2Handle i_handle);
+
+    Lighthouse2Material& GetMaterial(HdLighthouse2Handle i_handle) { return _ltMaterials[i_handle]; }
+
+    // Scene staging is double buffered: Sync fills the back slot (the update
+    // queue) while the core renders the front one (what it got at the last
+    // SynchronizeSceneData). UpdateScene is the swap point, the render
+    // thread calls it between passes to apply every update queued so far.
+    // Returns true if the render must restart.
     bool UpdateScene();
 
+    // Non-blocking present: takes the last pass the render thread
+    // published, if any, and lets it continue. With i_readback the pass is
+    // read back asynchronously and GetFramePixels is updated with the most
+    // recent pass whose readback completed; otherwise the pass is copied to
+    // the display target. Returns true if GetFramePixels or the display
+    // target changed. Needs the GL context.
+    bool PresentFrame(bool i_readback);
+
+    // the last pass copied by PresentFrame, nullptr until there is one
+    GLTexture* GetDisplayTarget() const { return _hasDisplayFrame ? _ltDisplayTarget : nullptr; }
+
+    // the last pass read back, linear color, top row first
+    const std::vector<float4>& GetFramePixels() const { return _ltFramePixels; }
+
+    // shading attributes of every instance in the scene, by node ID
+    const std::vector<Lighthouse2Utils::InstanceAttributes>& GetInstanceAttributes() const { return _ltInstanceAttributes; }
+
+    // camera used to cull instances, called by the render pass when it changes
+    void SetCullingView(const pxr::GfMatrix4d& i_view, const pxr::GfMatrix4d& i_proj, int i_height);
+
     virtual pxr::TfToken GetMaterialBindingPurpose() const override;
 
 #if HD_API_VERSION < 41
@@ -147,29 +318,143 @@ public:
 
 private:
     void _Initialize();
+    // progressive loop owned by the render thread, runs until stopped
+    void _RenderLoop();
+    struct _RemovalUpdate;
+    // apply the updates queued by Sync, in the order they were pushed
+    void _ApplySceneUpdates();
+    // build, refit or move a dirty mesh/light
+    void _UpdateMesh(Lighthouse2Mesh& i_mesh, bool i_share);
+
+    // Optional host-side culling of instancer prototypes: instances outside
+    // the view frustum or smaller than minPixelSize are not added to the
+    // scene. Instances in the scene use a larger margin so they don't flicker.
+    struct InstanceCulling {
+        bool enabled = false;
+        float minPixelSize = 1.0f; // projected diameter, 0 disables it
+        float margin = 0.1f; // hysteresis, fraction of bounds and size
+        // re-cull every instanced mesh; set under the renderer mutex but
+        // also checked without it by UpdateScene
+        std::atomic<bool> viewChanged{ false };
+        float4 planes[6]; // view frustum, world space, inward normals
+        float4 clipW; // world position to clip w
+        float pixelScale = 0.0f; // projected size of 1 unit at distance 1, in pixels
+        bool orthographic = false;
+    };
+    bool _IsInstanceVisible(const Lighthouse2Mesh& i_mesh, const mat4& i_transform, bool i_wasVisible) const;
+
+    // give a detached material a scene ID, reusing a released one if any
+    void _AddSceneMaterial(Lighthouse2Material& io_material);
+    int _GetMaterialIdForMesh(const Lighthouse2Mesh& i_mesh);
+    void _BuildTriangles(Lighthouse2Mesh& i_mesh);
+    // first upload: add the mesh to the scene and instance it
+    void _BuildMesh(Lighthouse2Mesh& i_mesh);
+    // deforming mesh: update the triangles in place, keep the mesh ID and its instances
+    void _RefitMesh(Lighthouse2Mesh& i_mesh);
+    void _AddInstances(Lighthouse2Mesh& i_mesh);
+    // add, remove or move instances to match newTransforms, and the culling
+    void _DiffInstances(Lighthouse2Mesh& i_mesh);
+    // move, cull or uncull only the changedInstances
+    void _PatchInstances(Lighthouse2Mesh& i_mesh);
+    void _RemoveInstances(Lighthouse2Mesh& i_mesh);
+    // remove a mesh/light, its instances, and its HostMesh once unused
+    void _RemoveMesh(Lighthouse2Utils::SlotMap<Lighthouse2Mesh>& i_meshes, HdLighthouse2Handle i_handle, bool i_releaseMaterial);
+    // HostMeshes can't leave the lighthouse2 scene: released ones are
+    // emptied and handed out again instead of growing the mesh pool
+    HostMesh* _AcquireSceneMesh();
+    void _ReleaseHostMesh(HostMesh* i_mesh);
+    // remove an instance from the scene and reset its attributes
+    void _RemoveNode(int i_nodeID);
+    void _SetInstanceAttributes(int i_nodeID, const Lighthouse2Mesh& i_mesh, size_t i_instance);
+    // copy the render target to the next readback buffer, on the GPU
+    void _StartReadback();
+    // map the newest completed readback into _ltFramePixels, true if any
+    bool _FinishReadbacks();
+    void _DiscardReadbacks();
+    // instance an existing HostMesh with the same content, returns false if
+    // the caller has to build/refit i_mesh->mesh itself.
+    bool _ShareMesh(Lighthouse2Mesh& i_mesh);
+    // stop sharing, copying the geometry if others still use it
+    void _UnshareMesh(Lighthouse2Mesh& i_mesh);
+    // drop a shared geometry entry and its material reference
+    void _EraseSharedGeometry(std::unordered_map<size_t, SharedGeometry>::iterator i_shared);
 
     static const pxr::TfTokenVector SUPPORTED_RPRIM_TYPES;
     static const pxr::TfTokenVector SUPPORTED_SPRIM_TYPES;
     static const pxr::TfTokenVector SUPPORTED_BPRIM_TYPES;
 
+    // shared by all delegates of the process, created by the first one
     static std::mutex _mutexResourceRegistry;
     static std::atomic_int _counterResourceRegistry;
     static HdResourceRegistrySharedPtr _resourceRegistry;
+    static std::shared_ptr<pxr::HdInstanceRegistry<HdLighthouse2TopologySharedPtr>> _topologyRegistry;
+    static std::shared_mutex _topologyRegistryMutex;
 
-    std::mutex _rendererMutex;
+    mutable std::mutex _rendererMutex;
     std::mutex _primIndexMutex;
 
     std::map<pxr::TfToken, UpdateRenderSettingFunction> _settingFunctions;
+    InstanceCulling _ltCulling;
 
+    Lighthouse2Utils::MpscQueue<SceneUpdate> _sceneUpdates;
+
+    // the process-wide scene (see HasScene), the mutex guards its ownership
+    static std::mutex _ltSceneMutex;
+    static const HdLighthouse2RenderDelegate* _ltSceneOwner;
     static RenderAPI* _ltRenderer;
-    static GLTexture* _ltRenderTarget;
     static Shader* _ltShader;
-    static uint _ltCar;
-    static std::map<pxr::SdfPath, Lighthouse2Mesh> _ltMeshes;
-    static std::map<pxr::SdfPath, Lighthouse2Mesh> _ltLights; // area/rect lights
-    static std::map<pxr::SdfPath, Lighthouse2Material> _ltMaterials;
-    static std::map<pxr::SdfPath, pxr::SdfPath > _ltMeshToMaterialMap;
-    static int _ltDefaultMaterial;
+    // Released scene resources, reused before adding new ones. They stay in
+    // the static pools when the renderer is shut down, so the lists are kept
+    // for the next delegate.
+    static std::vector<HostMesh*> _ltFreeHostMeshes;
+    static std::vector<HostMaterial*> _ltFreeMaterials;
+    bool _ltOwnsScene = false;
+
+    // scene content of this delegate
+    GLTexture* _ltRenderTarget = nullptr;
+    uint _ltCar = 0;
+    Lighthouse2Utils::SlotMap<Lighthouse2Mesh> _ltMeshes;
+    Lighthouse2Utils::SlotMap<Lighthouse2Mesh> _ltLights; // area/rect lights
+    Lighthouse2Utils::SlotMap<Lighthouse2Material> _ltMaterials;
+    std::unordered_map<pxr::SdfPath, HdLighthouse2Handle, pxr::SdfPath::Hash> _ltMaterialHandles;
+    std::unordered_map<size_t, SharedGeometry> _ltSharedGeometry;
+    // what UpdateScene has to look at, filled while applying scene updates
+    std::vector<HdLighthouse2Handle> _ltDirtyMeshes;
+    std::vector<HdLighthouse2Handle> _ltDirtyLights;
+    std::vector<HdLighthouse2Handle> _ltNewMaterials;
+    // moved instances, submitted together at the end of UpdateScene
+    std::vector<int> _ltPendingNodeIDs;
+    std::vector<mat4> _ltPendingNodeTransforms;
+    std::vector<Lighthouse2Utils::InstanceAttributes> _ltInstanceAttributes;
+    int _ltDefaultMaterial = -1;
+
+    // the render thread publishes a pass, PresentFrame copies it to the
+    // display target before the next pass overwrites the render target
+    GLTexture* _ltDisplayTarget = nullptr;
+    std::vector<float4> _ltFramePixels;
+
+    // Ring of pixel buffers the presented passes are read back through:
+    // the copy of pass N completes while pass N+1 renders, its fence tells
+    // when the pixels can be mapped without stalling.
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr; // pending copy, null when the slot is free
+        int width = 0;
+        int height = 0;
+        uint64_t frame = 0;
+    };
+    static constexpr int READBACK_RING_SIZE = 3;
+    std::array<Readback, READBACK_RING_SIZE> _ltReadbacks;
+    int _ltNextReadback = 0;
+    uint64_t _ltReadbackFrame = 0; // presented passes, to order the slots
+    std::mutex _frameMutex;
+    std::condition_variable _frameConsumed;
+    bool _frameReady = false;
+    bool _hasDisplayFrame = false;
+    // bumped each time the render thread starts, readbacks of an older
+    // run are dropped
+    uint64_t _frameGeneration = 0;
+    uint64_t _readbackGeneration = 0;
 
     pxr::HdRenderThread _renderThread;
 };
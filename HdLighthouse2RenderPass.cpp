@@ -59,7 +59,12 @@ void HdLighthouse2RenderPass::_Execute(
     pxr::HdRenderPassStateSharedPtr const& renderPassState,
     pxr::TfTokenVector const& renderTags)
 {
+    // another delegate owns the process' lighthouse2 scene
+    if (!_owner->HasScene())
+        return;
+
     bool needStartRender = false;
+    bool clearAovs = false;
 
     // has the camera moved ?
     //
@@ -86,15 +91,15 @@ void HdLighthouse2RenderPass::_Execute(
         _colorBuffer.Allocate(dimensions, pxr::HdFormatFloat16Vec4, false);
 
         _owner->ResizeBuffer(_dataWindow.GetWidth(), _dataWindow.GetHeight());
+        clearAovs = true;
     }
 
-    // empty AOVs ?
+    // empty AOVs ? then draw straight to the bound framebuffer
     //
     pxr::HdRenderPassAovBindingVector aovBindings = renderPassState->GetAovBindings();
-    if (aovBindings.empty())
+    const bool drawToFramebuffer = aovBindings.empty();
+    if (drawToFramebuffer)
     {
-        _renderThread->StopRender();
-        needStartRender = true;
         pxr::HdRenderPassAovBinding colorAov;
         colorAov.aovName = HdAovTokens->color;
         colorAov.renderBuffer = &_colorBuffer;
@@ -102,36 +107,20 @@ void HdLighthouse2RenderPass::_Execute(
         aovBindings.push_back(colorAov);
     }
 
-    //if (aovBindings.size() > 0 && aovBindings[0].aovName == HdAovTokens->color)
-    //{
-    //    std::cout << "found color" << std::endl;
-
-    //    HdLighthouse2RenderBuffer* rb = static_cast<HdLighthouse2RenderBuffer*>(aovBindings[0].renderBuffer);
-    //    //rb->Map();
-    //    
-    //    GfVec4f sample(1.0,0.0,0.0,1.0);
-    //    float* sampleData = sample.data();
-    //    for(int x =0;x<100;++x)
-    //        for (int y = 0; y < 100; ++y)
-    //            rb->Write(GfVec3i(x,y, 1), 4, sampleData);
-
-    //    //rb->Unmap();
-    //}
-
     if(_aovBindings != aovBindings)
     {
         _renderThread->StopRender();
         needStartRender = true;
         _aovBindings = aovBindings;
+        clearAovs = true;
     }
 
-    if( needStartRender )
+    if (clearAovs)
     {
-        _renderThread->StartRender();
+        _ClearAovs();
     }
 
     auto* ltRenderer = _owner->GetRenderer();
-    auto* ltRenderTarget = _owner->GetRenderTarget();
     auto* ltShader = _owner->GetShader();
     auto* ltCamera = ltRenderer->GetCamera();
     // get camera from renderPassState or from RenderSettings
@@ -174,43 +163,121 @@ void HdLighthouse2RenderPass::_Execute(
     passMatrixLT[7] = passMatrix.data()[13];
     passMatrixLT[11] = passMatrix.data()[14];
 
-    ltCamera->SetMatrix(passMatrixLT);
-
     const float focusDistance = hdCamera->GetFocusDistance();
     const float fStop = hdCamera->GetFStop();
     const float focalLength = hdCamera->GetFocalLength();
     const float verticalAperture = hdCamera->GetVerticalAperture();
-    
-    if (focusDistance > 0.0f)
-        ltCamera->focalDistance = focusDistance;
-    else
-        ltCamera->focalDistance = 5.0f;
- 
-    if (fStop > 0.0f && focusDistance > 0.0f)
-        ltCamera->aperture = fStop;
-    else
-        ltCamera->aperture = EPSILON; // small, for non - defocus ?
 
+    const float ltFocalDistance = focusDistance > 0.0f ? focusDistance : 5.0f;
+    // small, for non - defocus ?
+    const float ltAperture = (fStop > 0.0f && focusDistance > 0.0f) ? fStop : EPSILON;
+    float ltFOV = 90.0f;
     if (focalLength > 0) 
     {
         const float r = verticalAperture / focalLength;
-        const float fov = 2.0f * GfRadiansToDegrees(std::atan(0.5f * r));
-        ltCamera->FOV = fov;
+        ltFOV = 2.0f * GfRadiansToDegrees(std::atan(0.5f * r));
     }
-    else
-        ltCamera->FOV = 90.0f;
 
-    ltCamera->pixelCount = make_int2(1, 1);
+    // the render thread reads the camera, only touch it while stopped
+    if (ltCamera->focalDistance != ltFocalDistance || ltCamera->aperture != ltAperture || ltCamera->FOV != ltFOV)
+    {
+        _renderThread->StopRender();
+        needStartRender = true;
+    }
 
-    // update render
-    //
-    bool needsRestart = _owner->UpdateScene();
+    if( needStartRender )
+    {
+        ltCamera->SetMatrix(passMatrixLT);
+        ltCamera->focalDistance = ltFocalDistance;
+        ltCamera->aperture = ltAperture;
+        ltCamera->FOV = ltFOV;
+        ltCamera->pixelCount = make_int2(1, 1);
+
+        _owner->SetCullingView(_viewMatrix, _projMatrix, _dataWindow.GetHeight());
+        _renderThread->StartRender();
+    }
+
+    // the render thread owns the progressive loop and applies the scene
+    // updates between passes; this only takes its latest pass, never waiting
+    if (drawToFramebuffer)
+    {
+        _owner->PresentFrame(false);
+        if (GLTexture* frame = _owner->GetDisplayTarget())
+        {
+            _DrawRenderTarget(frame, ltShader, ltCamera);
+        }
+    }
+    else if (_owner->PresentFrame(true))
+    {
+        _WriteAovs();
+    }
+}
 
-    ltRenderer->SynchronizeSceneData();
-    ltRenderer->Render( (ltCamera->Changed() || needsRestart) ? lighthouse2::Convergence::Restart : lighthouse2::Convergence::Converge);
+static void _ClearAov(HdLighthouse2RenderBuffer* rb, pxr::VtValue const& clearValue)
+{
+    if (clearValue.IsHolding<float>())
+    {
+        const float value = clearValue.UncheckedGet<float>();
+        rb->Clear(1, &value);
+    }
+    else if (clearValue.IsHolding<pxr::GfVec3f>())
+    {
+        rb->Clear(3, clearValue.UncheckedGet<pxr::GfVec3f>().data());
+    }
+    else if (clearValue.IsHolding<pxr::GfVec4f>())
+    {
+        rb->Clear(4, clearValue.UncheckedGet<pxr::GfVec4f>().data());
+    }
+    else if (clearValue.IsHolding<int>())
+    {
+        const int value = clearValue.UncheckedGet<int>();
+        rb->Clear(1, &value);
+    }
+}
+
+void HdLighthouse2RenderPass::_ClearAovs()
+{
+    for (auto const& binding : _aovBindings)
+    {
+        auto* rb = static_cast<HdLighthouse2RenderBuffer*>(binding.renderBuffer);
+        if (!rb || rb->GetWidth() == 0)
+            continue;
+
+        rb->Map();
+        _ClearAov(rb, binding.clearValue);
+        rb->Unmap();
+        // the core only outputs color, the other AOVs keep their clear value
+        rb->SetConverged(binding.aovName != HdAovTokens->color);
+    }
+}
 
-    ltRenderer->WaitForRender();
+void HdLighthouse2RenderPass::_WriteAovs()
+{
+    const std::vector<float4>& pixels = _owner->GetFramePixels();
+    const int width = _dataWindow.GetWidth();
+    const int height = _dataWindow.GetHeight();
+    if (pixels.size() != size_t(width) * height || height == 0)
+        return;
+
+    for (auto const& binding : _aovBindings)
+    {
+        if (binding.aovName != HdAovTokens->color)
+            continue;
+        auto* rb = static_cast<HdLighthouse2RenderBuffer*>(binding.renderBuffer);
+        // being reallocated to the new size, wait for the next pass
+        if (!rb || rb->GetWidth() != width || rb->GetHeight() != height)
+            continue;
+
+        // lighthouse2 rows go top-down, hydra's bottom-up
+        rb->Map();
+        rb->WriteRows(0, height, 4, &pixels[size_t(height - 1) * width].x,
+            -ptrdiff_t(width * sizeof(float4)));
+        rb->Unmap();
+    }
+}
 
+void HdLighthouse2RenderPass::_DrawRenderTarget(GLTexture* ltRenderTarget, Shader* ltShader, Camera* ltCamera)
+{
     // draw render-target on screen
     //
     glDisable(GL_BLEND);
@@ -31,6 +31,14 @@ protected:
 
     void _MarkCollectionDirty() override {}
 
+    // tonemap the last completed frame into the bound framebuffer
+    void _DrawRenderTarget(GLTexture* ltRenderTarget, Shader* ltShader, Camera* ltCamera);
+
+    // fill the bound AOVs with their clear values, after a binding change
+    void _ClearAovs();
+    // write the last pass read back by the delegate into the bound AOVs
+    void _WriteAovs();
+
 private:
     HdLighthouse2RenderDelegate* _owner;
 
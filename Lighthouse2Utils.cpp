@@ -1,7 +1,124 @@
 #include "Lighthouse2Utils.h"
 
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
 namespace Lighthouse2Utils
 {
+	// triangles per task in the parallel loops below
+	static const size_t kTriangleGrainSize = 1024;
+
+	// min is exact, so the result does not depend on the order in which
+	// the triangles sharing a vertex get there.
+	static inline void AtomicMin(std::atomic<float>& io_value, const float i_value)
+	{
+		float current = io_value.load(std::memory_order_relaxed);
+		while (i_value < current && !io_value.compare_exchange_weak(current, i_value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// per-vertex alphas for consistent normal interpolation
+	static void ComputeAlphas(
+		const std::vector<int>& tmpIndices,
+		const std::vector<float3>& tmpVertices,
+		const std::vector<float3>& tmpNormals,
+		std::vector<float>& tmpAlphas)
+	{
+		const size_t vertexCount = tmpVertices.size();
+		const size_t triangleCount = tmpIndices.size() / 3;
+		std::vector<std::atomic<float>> minDots(vertexCount); // we will have one alpha value per unique vertex
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, vertexCount, 4096),
+			[&](const tbb::blocked_range<size_t>& r)
+			{
+				for (size_t i = r.begin(); i < r.end(); i++)
+					minDots[i].store(1.0f, std::memory_order_relaxed);
+			});
+
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, triangleCount, kTriangleGrainSize),
+			[&](const tbb::blocked_range<size_t>& r)
+			{
+				for (size_t i = r.begin() * 3, s = r.end() * 3; i < s; i += 3)
+				{
+					const uint v0idx = tmpIndices[i + 0], v1idx = tmpIndices[i + 1], v2idx = tmpIndices[i + 2];
+					const float3 vert0 = tmpVertices[v0idx], vert1 = tmpVertices[v1idx], vert2 = tmpVertices[v2idx];
+					float3 N = normalize(cross(vert1 - vert0, vert2 - vert0));
+					float3 vN0, vN1, vN2;
+					if (tmpNormals.size() > 0)
+					{
+						vN0 = tmpNormals[v0idx], vN1 = tmpNormals[v1idx], vN2 = tmpNormals[v2idx];
+						if (dot(N, vN0) < 0 && dot(N, vN1) < 0 && dot(N, vN2) < 0) N *= -1.0f; // flip if not consistent with vertex normals
+					}
+					else
+					{
+						// no normals supplied; copy face normal
+						vN0 = vN1 = vN2 = N;
+					}
+					// Note: we clamp at approx. 45 degree angles; beyond this the approach fails.
+					AtomicMin(minDots[v0idx], dot(vN0, N));
+					AtomicMin(minDots[v1idx], dot(vN1, N));
+					AtomicMin(minDots[v2idx], dot(vN2, N));
+				}
+			});
+
+		tmpAlphas.resize(vertexCount);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, vertexCount, 4096),
+			[&](const tbb::blocked_range<size_t>& r)
+			{
+				for (size_t i = r.begin(); i < r.end(); i++)
+				{
+					const float nnv = minDots[i].load(std::memory_order_relaxed);
+					tmpAlphas[i] = acosf(nnv) * (1 + 0.03632f * (1 - nnv) * (1 - nnv));
+				}
+			});
+	}
+
+	// tangent frame from the triangle uvs, or from its edges if there are none
+	static void ComputeTangents(HostTri& tri, const float3& N, const bool hasUvs)
+	{
+		if (hasUvs)
+		{
+			// calculate tangent vector based on uvs
+			float2 uv01 = make_float2(tri.u1 - tri.u0, tri.v1 - tri.v0);
+			float2 uv02 = make_float2(tri.u2 - tri.u0, tri.v2 - tri.v0);
+			if (dot(uv01, uv01) == 0 || dot(uv02, uv02) == 0)
+			{
+#if 1
+				// PBRT:
+				// https://github.com/mmp/pbrt-v3/blob/3f94503ae1777cd6d67a7788e06d67224a525ff4/src/shapes/triangle.cpp#L381
+				if (std::abs(N.x) > std::abs(N.y))
+					tri.T = make_float3(-N.z, 0, N.x) / std::sqrt(N.x * N.x + N.z * N.z);
+				else
+					tri.T = make_float3(0, N.z, -N.y) / std::sqrt(N.y * N.y + N.z * N.z);
+#else
+				tri.T = normalize(tri.vertex1 - tri.vertex0);
+#endif
+				tri.B = normalize(cross(N, tri.T));
+			}
+			else
+			{
+				tri.T = normalize((tri.vertex1 - tri.vertex0) * uv02.y - (tri.vertex2 - tri.vertex0) * uv01.y);
+				tri.B = normalize((tri.vertex2 - tri.vertex0) * uv01.x - (tri.vertex1 - tri.vertex0) * uv02.x);
+			}
+			// catch bad tangents
+			if (isnan(tri.T.x + tri.T.y + tri.T.z + tri.B.x + tri.B.y + tri.B.z))
+			{
+				tri.T = normalize(tri.vertex1 - tri.vertex0);
+				tri.B = normalize(cross(N, tri.T));
+			}
+		}
+		else
+		{
+			// no uv information; use edges to calculate tangent vectors
+			tri.T = normalize(tri.vertex1 - tri.vertex0);
+			tri.B = normalize(cross(N, tri.T));
+		}
+	}
+
 	void XformComponentsPxrToLighthouse2(
 		const pxr::GfVec3f& t, 
 		const pxr::GfMatrix3f& rm, 
@@ -37,6 +154,59 @@ namespace Lighthouse2Utils
 		o_matrix = translation_m * rotation_m;
 	}
 
+	void CopyVec3f(
+		const pxr::GfVec3f* i_src,
+		const size_t i_count,
+		float3* o_dst)
+	{
+		static_assert(sizeof(float3) == sizeof(pxr::GfVec3f), "float3 and GfVec3f must have the same layout");
+		if (i_count > 0)
+			std::memcpy(o_dst, i_src, i_count * sizeof(float3));
+	}
+
+	void ComputeSmoothNormals(
+		const pxr::Hd_VertexAdjacency& i_adjacency,
+		const size_t i_numPoints,
+		const pxr::GfVec3f* i_points,
+		float3* o_normals)
+	{
+		// same layout as Hd_SmoothNormals: for each point an (offset, valence)
+		// pair, then at offset valence (prev, next) pairs of neighbours.
+		const int* entry = i_adjacency.GetAdjacencyTable().cdata();
+		const size_t numPoints = std::min(i_numPoints, (size_t)i_adjacency.GetNumPoints());
+		const float* P = reinterpret_cast<const float*>(i_points);
+
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, numPoints, 4096),
+			[&](const tbb::blocked_range<size_t>& r)
+			{
+				for (size_t i = r.begin(); i < r.end(); ++i)
+				{
+					const int offset = entry[i * 2 + 0];
+					const int valence = entry[i * 2 + 1];
+					const int* e = entry + offset;
+					const float cx = P[i * 3 + 0], cy = P[i * 3 + 1], cz = P[i * 3 + 2];
+					float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+					for (int j = 0; j < valence; ++j)
+					{
+						const float* prev = P + e[j * 2 + 0] * 3;
+						const float* next = P + e[j * 2 + 1] * 3;
+						const float ax = next[0] - cx, ay = next[1] - cy, az = next[2] - cz;
+						const float bx = prev[0] - cx, by = prev[1] - cy, bz = prev[2] - cz;
+						nx += ay * bz - az * by;
+						ny += az * bx - ax * bz;
+						nz += ax * by - ay * bx;
+					}
+					const float len = sqrtf(nx * nx + ny * ny + nz * nz);
+					const float invLen = len > 0.0f ? 1.0f / len : 0.0f;
+					o_normals[i] = make_float3(nx * invLen, ny * invLen, nz * invLen);
+				}
+			});
+
+		// points not referenced by the topology
+		for (size_t i = numPoints; i < i_numPoints; ++i)
+			o_normals[i] = make_float3(0, 0, 0);
+	}
+
 	void UpdateVertices(
 		HostMesh* i_mesh,
 		const std::vector<int>& tmpIndices,
@@ -64,117 +234,139 @@ namespace Lighthouse2Utils
 	{
 		// calculate values for consistent normal interpolation
 		std::vector<float> tmpAlphas;
-		tmpAlphas.resize(tmpVertices.size(), 1.0f); // we will have one alpha value per unique vertex
-		for (size_t s = tmpIndices.size(), i = 0; i < s; i += 3)
-		{
-			const uint v0idx = tmpIndices[i + 0], v1idx = tmpIndices[i + 1], v2idx = tmpIndices[i + 2];
-			const float3 vert0 = tmpVertices[v0idx], vert1 = tmpVertices[v1idx], vert2 = tmpVertices[v2idx];
-			float3 N = normalize(cross(vert1 - vert0, vert2 - vert0));
-			float3 vN0, vN1, vN2;
-			if (tmpNormals.size() > 0)
-			{
-				vN0 = tmpNormals[v0idx], vN1 = tmpNormals[v1idx], vN2 = tmpNormals[v2idx];
-				if (dot(N, vN0) < 0 && dot(N, vN1) < 0 && dot(N, vN2) < 0) N *= -1.0f; // flip if not consistent with vertex normals
-			}
-			else
-			{
-				// no normals supplied; copy face normal
-				vN0 = vN1 = vN2 = N;
-			}
-			// Note: we clamp at approx. 45 degree angles; beyond this the approach fails.
-			tmpAlphas[v0idx] = min(tmpAlphas[v0idx], dot(vN0, N));
-			tmpAlphas[v1idx] = min(tmpAlphas[v1idx], dot(vN1, N));
-			tmpAlphas[v2idx] = min(tmpAlphas[v2idx], dot(vN2, N));
-		}
-		for (size_t s = tmpAlphas.size(), i = 0; i < s; i++)
-		{
-			const float nnv = tmpAlphas[i]; // temporarily stored there
-			tmpAlphas[i] = acosf(nnv) * (1 + 0.03632f * (1 - nnv) * (1 - nnv));
-		}
+		ComputeAlphas(tmpIndices, tmpVertices, tmpNormals, tmpAlphas);
 		// build final mesh structures
+		// everything is pre-sized, so each task only writes its own triangles
 		const size_t newTriangleCount = tmpIndices.size() / 3;
-		size_t triIdx = i_mesh->triangles.size();
-		i_mesh->triangles.resize(triIdx + newTriangleCount);
-		for (size_t i = 0; i < newTriangleCount; i++, triIdx++)
-		{
-			HostTri& tri = i_mesh->triangles[triIdx];
-			tri.material = materialIdx;
-			const uint v0idx = tmpIndices[i * 3 + 0];
-			const uint v1idx = tmpIndices[i * 3 + 1];
-			const uint v2idx = tmpIndices[i * 3 + 2];
-			const float3 v0pos = tmpVertices[v0idx];
-			const float3 v1pos = tmpVertices[v1idx];
-			const float3 v2pos = tmpVertices[v2idx];
-			i_mesh->vertices.push_back(make_float4(v0pos, 1));
-			i_mesh->vertices.push_back(make_float4(v1pos, 1));
-			i_mesh->vertices.push_back(make_float4(v2pos, 1));
-			const float3 N = normalize(cross(v1pos - v0pos, v2pos - v0pos));
-			tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
-			tri.vertex0 = tmpVertices[v0idx];
-			tri.vertex1 = tmpVertices[v1idx];
-			tri.vertex2 = tmpVertices[v2idx];
-			tri.alpha = make_float3(tmpAlphas[v0idx], tmpAlphas[v1idx], tmpAlphas[v2idx]);
-			if (tmpNormals.size() > 0)
-				tri.vN0 = tmpNormals[v0idx],
-				tri.vN1 = tmpNormals[v1idx],
-				tri.vN2 = tmpNormals[v2idx];
-			else
-				tri.vN0 = tri.vN1 = tri.vN2 = N;
-			if (tmpUvs.size() > 0)
+		const size_t triBase = i_mesh->triangles.size();
+		const size_t vertBase = i_mesh->vertices.size();
+		i_mesh->triangles.resize(triBase + newTriangleCount);
+		i_mesh->vertices.resize(vertBase + newTriangleCount * 3);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, newTriangleCount, kTriangleGrainSize),
+			[&](const tbb::blocked_range<size_t>& r)
 			{
-				tri.u0 = tmpUvs[i * 3 + 0].x, tri.v0 = tmpUvs[i * 3 + 0].y;
-				tri.u1 = tmpUvs[i * 3 + 1].x, tri.v1 = tmpUvs[i * 3 + 1].y;
-				tri.u2 = tmpUvs[i * 3 + 2].x, tri.v2 = tmpUvs[i * 3 + 2].y;
-				if (tri.u0 == tri.u1 && tri.u1 == tri.u2 && tri.v0 == tri.v1 && tri.v1 == tri.v2)
+				for (size_t i = r.begin(); i < r.end(); i++)
 				{
-					// this triangle uses only a single point on the texture; replace by single color material.
-					int textureID = HostScene::materials[materialIdx]->color.textureID;
-					if (textureID != -1)
+					HostTri& tri = i_mesh->triangles[triBase + i];
+					tri.material = materialIdx;
+					const uint v0idx = tmpIndices[i * 3 + 0];
+					const uint v1idx = tmpIndices[i * 3 + 1];
+					const uint v2idx = tmpIndices[i * 3 + 2];
+					const float3 v0pos = tmpVertices[v0idx];
+					const float3 v1pos = tmpVertices[v1idx];
+					const float3 v2pos = tmpVertices[v2idx];
+					i_mesh->vertices[vertBase + i * 3 + 0] = make_float4(v0pos, 1);
+					i_mesh->vertices[vertBase + i * 3 + 1] = make_float4(v1pos, 1);
+					i_mesh->vertices[vertBase + i * 3 + 2] = make_float4(v2pos, 1);
+					const float3 N = normalize(cross(v1pos - v0pos, v2pos - v0pos));
+					tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
+					tri.vertex0 = v0pos;
+					tri.vertex1 = v1pos;
+					tri.vertex2 = v2pos;
+					tri.alpha = make_float3(tmpAlphas[v0idx], tmpAlphas[v1idx], tmpAlphas[v2idx]);
+					if (tmpNormals.size() > 0)
+						tri.vN0 = tmpNormals[v0idx],
+						tri.vN1 = tmpNormals[v1idx],
+						tri.vN2 = tmpNormals[v2idx];
+					else
+						tri.vN0 = tri.vN1 = tri.vN2 = N;
+					if (tmpUvs.size() > 0)
 					{
-						HostTexture* texture = HostScene::textures[textureID];
-						uint u = (uint)(tri.u0 * texture->width) % texture->width;
-						uint v = (uint)(tri.v0 * texture->height) % texture->height;
-						uint texel = ((uint*)texture->idata)[u + v * texture->width] & 0xffffff;
-						tri.material = HostScene::FindOrCreateMaterialCopy(materialIdx, texel);
-						int w = 0;
+						tri.u0 = tmpUvs[i * 3 + 0].x, tri.v0 = tmpUvs[i * 3 + 0].y;
+						tri.u1 = tmpUvs[i * 3 + 1].x, tri.v1 = tmpUvs[i * 3 + 1].y;
+						tri.u2 = tmpUvs[i * 3 + 2].x, tri.v2 = tmpUvs[i * 3 + 2].y;
 					}
+					ComputeTangents(tri, N, tmpUvs.size() > 0);
 				}
-				// calculate tangent vector based on uvs
-				float2 uv01 = make_float2(tri.u1 - tri.u0, tri.v1 - tri.v0);
-				float2 uv02 = make_float2(tri.u2 - tri.u0, tri.v2 - tri.v0);
-				if (dot(uv01, uv01) == 0 || dot(uv02, uv02) == 0)
+			});
+
+		// FindOrCreateMaterialCopy touches the scene, keep it serial
+		const int textureID = tmpUvs.size() > 0 ? HostScene::materials[materialIdx]->color.textureID : -1;
+		if (textureID != -1)
+		{
+			HostTexture* texture = HostScene::textures[textureID];
+			for (size_t i = 0; i < newTriangleCount; i++)
+			{
+				HostTri& tri = i_mesh->triangles[triBase + i];
+				if (tri.u0 == tri.u1 && tri.u1 == tri.u2 && tri.v0 == tri.v1 && tri.v1 == tri.v2)
 				{
-#if 1
-					// PBRT:
-					// https://github.com/mmp/pbrt-v3/blob/3f94503ae1777cd6d67a7788e06d67224a525ff4/src/shapes/triangle.cpp#L381
-					if (std::abs(N.x) > std::abs(N.y))
-						tri.T = make_float3(-N.z, 0, N.x) / std::sqrt(N.x * N.x + N.z * N.z);
-					else
-						tri.T = make_float3(0, N.z, -N.y) / std::sqrt(N.y * N.y + N.z * N.z);
-#else
-					tri.T = normalize(tri.vertex1 - tri.vertex0);
-#endif
-					tri.B = normalize(cross(N, tri.T));
+					// this triangle uses only a single point on the texture; replace by single color material.
+					uint u = (uint)(tri.u0 * texture->width) % texture->width;
+					uint v = (uint)(tri.v0 * texture->height) % texture->height;
+					uint texel = ((uint*)texture->idata)[u + v * texture->width] & 0xffffff;
+					tri.material = HostScene::FindOrCreateMaterialCopy(materialIdx, texel);
 				}
-				else
+			}
+		}
+	}
+
+	void RefitFromIndexedData(
+		HostMesh* i_mesh,
+		const std::vector<int>& tmpIndices,
+		const std::vector<float3>& tmpVertices, // vertex
+		const std::vector<float3>& tmpNormals, // vertex
+		const bool hasUvs)
+	{
+		// topology, uvs and materials are kept, only the geometry moves
+		const size_t triangleCount = tmpIndices.size() / 3;
+		if (triangleCount != i_mesh->triangles.size())
+			return;
+
+		std::vector<float> tmpAlphas;
+		ComputeAlphas(tmpIndices, tmpVertices, tmpNormals, tmpAlphas);
+
+		i_mesh->vertices.resize(triangleCount * 3);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, triangleCount, kTriangleGrainSize),
+			[&](const tbb::blocked_range<size_t>& r)
+			{
+				for (size_t i = r.begin(); i < r.end(); i++)
 				{
-					tri.T = normalize((tri.vertex1 - tri.vertex0) * uv02.y - (tri.vertex2 - tri.vertex0) * uv01.y);
-					tri.B = normalize((tri.vertex2 - tri.vertex0) * uv01.x - (tri.vertex1 - tri.vertex0) * uv02.x);
+					HostTri& tri = i_mesh->triangles[i];
+					const uint v0idx = tmpIndices[i * 3 + 0];
+					const uint v1idx = tmpIndices[i * 3 + 1];
+					const uint v2idx = tmpIndices[i * 3 + 2];
+					const float3 v0pos = tmpVertices[v0idx];
+					const float3 v1pos = tmpVertices[v1idx];
+					const float3 v2pos = tmpVertices[v2idx];
+					i_mesh->vertices[i * 3 + 0] = make_float4(v0pos, 1);
+					i_mesh->vertices[i * 3 + 1] = make_float4(v1pos, 1);
+					i_mesh->vertices[i * 3 + 2] = make_float4(v2pos, 1);
+					const float3 N = normalize(cross(v1pos - v0pos, v2pos - v0pos));
+					tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
+					tri.vertex0 = v0pos;
+					tri.vertex1 = v1pos;
+					tri.vertex2 = v2pos;
+					tri.alpha = make_float3(tmpAlphas[v0idx], tmpAlphas[v1idx], tmpAlphas[v2idx]);
+					if (tmpNormals.size() > 0)
+						tri.vN0 = tmpNormals[v0idx],
+						tri.vN1 = tmpNormals[v1idx],
+						tri.vN2 = tmpNormals[v2idx];
+					else
+						tri.vN0 = tri.vN1 = tri.vN2 = N;
+					ComputeTangents(tri, N, hasUvs);
 				}
-				// catch bad tangents
-				if (isnan(tri.T.x + tri.T.y + tri.T.z + tri.B.x + tri.B.y + tri.B.z))
+			});
+
+		// same triangle count: the core refits the existing acceleration
+		// structure instead of rebuilding it.
+		i_mesh->MarkAsDirty();
+	}
+
+	void SetNodeTransforms(
+		HostScene* i_scene,
+		const std::vector<int>& nodeIDs,
+		const std::vector<mat4>& transforms)
+	{
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, nodeIDs.size(), 4096),
+			[&](const tbb::blocked_range<size_t>& r)
+			{
+				for (size_t i = r.begin(); i < r.end(); i++)
 				{
-					tri.T = normalize(tri.vertex1 - tri.vertex0);
-					tri.B = normalize(cross(N, tri.T));
+					HostNode* node = i_scene->nodePool[nodeIDs[i]];
+					node->localTransform = transforms[i];
+					node->treeChanged = true;
 				}
-			}
-			else
-			{
-				// no uv information; use edges to calculate tangent vectors
-				tri.T = normalize(tri.vertex1 - tri.vertex0);
-				tri.B = normalize(cross(N, tri.T));
-			}
-		}
+			});
 	}
 
-}
+}
\ No newline at end of file
@@ -6,15 +6,177 @@
 #include "common_types.h"
 #include <pxr/base/gf/vec3f.h>
 #include <pxr/base/gf/matrix3f.h>
+#include <pxr/imaging/hd/vertexAdjacency.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
 
 namespace Lighthouse2Utils
 {
+	// Lock-free queue for many producers and a single consumer, of intrusive
+	// nodes linked through T::next. Producers push one node at a time, the
+	// consumer detaches everything pushed so far at once.
+	template <typename T>
+	class MpscQueue
+	{
+	public:
+		MpscQueue() : _head(nullptr) {}
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		void Push(T* i_node)
+		{
+			T* head = _head.load(std::memory_order_relaxed);
+			do
+			{
+				i_node->next = head;
+			} while (!_head.compare_exchange_weak(head, i_node, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		// Detach all pending nodes, returned in push order.
+		T* PopAll()
+		{
+			T* node = _head.exchange(nullptr, std::memory_order_acquire);
+			T* ordered = nullptr;
+			while (node)
+			{
+				T* next = node->next;
+				node->next = ordered;
+				ordered = node;
+				node = next;
+			}
+			return ordered;
+		}
+
+		bool Empty() const { return _head.load(std::memory_order_relaxed) == nullptr; }
+
+	private:
+		std::atomic<T*> _head;
+	};
+
+	// Stable reference to a SlotMap value, valid until that value is removed.
+	struct SlotHandle
+	{
+		uint32_t index = ~0u;
+		uint32_t generation = 0;
+
+		bool IsValid() const { return index != ~0u; }
+		bool operator==(const SlotHandle& i_other) const { return index == i_other.index && generation == i_other.generation; }
+		bool operator!=(const SlotHandle& i_other) const { return !(*this == i_other); }
+	};
+
+	// Values kept in contiguous storage and addressed by generational handles,
+	// with O(1) insert, lookup and remove. Removing moves the last value into
+	// the hole, so references to values don't survive an Insert or a Remove,
+	// handles do.
+	template <typename T>
+	class SlotMap
+	{
+	public:
+		SlotHandle Insert(T i_value)
+		{
+			uint32_t index;
+			if (!_freeSlots.empty())
+			{
+				index = _freeSlots.back();
+				_freeSlots.pop_back();
+			}
+			else
+			{
+				index = (uint32_t)_slots.size();
+				_slots.push_back(Slot());
+			}
+			_slots[index].dense = (uint32_t)_values.size();
+			_values.push_back(std::move(i_value));
+			_denseToSlot.push_back(index);
+
+			SlotHandle handle;
+			handle.index = index;
+			handle.generation = _slots[index].generation;
+			return handle;
+		}
+
+		bool Contains(SlotHandle i_handle) const
+		{
+			return i_handle.index < _slots.size()
+				&& _slots[i_handle.index].generation == i_handle.generation
+				&& _slots[i_handle.index].dense != kFree;
+		}
+
+		// nullptr if the handle is stale
+		T* Find(SlotHandle i_handle)
+		{
+			return Contains(i_handle) ? &_values[_slots[i_handle.index].dense] : nullptr;
+		}
+
+		// handle must be valid
+		T& operator[](SlotHandle i_handle) { return _values[_slots[i_handle.index].dense]; }
+
+		void Remove(SlotHandle i_handle)
+		{
+			if (!Contains(i_handle))
+				return;
+
+			Slot& slot = _slots[i_handle.index];
+			const uint32_t last = (uint32_t)_values.size() - 1;
+			if (slot.dense != last)
+			{
+				_values[slot.dense] = std::move(_values[last]);
+				_denseToSlot[slot.dense] = _denseToSlot[last];
+				_slots[_denseToSlot[slot.dense]].dense = slot.dense;
+			}
+			_values.pop_back();
+			_denseToSlot.pop_back();
+
+			slot.dense = kFree;
+			slot.generation++;
+			_freeSlots.push_back(i_handle.index);
+		}
+
+		size_t Size() const { return _values.size(); }
+
+		// contiguous iteration over the values, in no particular order
+		typename std::vector<T>::iterator begin() { return _values.begin(); }
+		typename std::vector<T>::iterator end() { return _values.end(); }
+		typename std::vector<T>::const_iterator begin() const { return _values.begin(); }
+		typename std::vector<T>::const_iterator end() const { return _values.end(); }
+
+	private:
+		static constexpr uint32_t kFree = ~0u;
+
+		struct Slot
+		{
+			uint32_t dense = kFree;
+			uint32_t generation = 0;
+		};
+
+		std::vector<T> _values;
+		std::vector<uint32_t> _denseToSlot;
+		std::vector<Slot> _slots;
+		std::vector<uint32_t> _freeSlots;
+	};
+
 	void XformComponentsPxrToLighthouse2(
 		const pxr::GfVec3f& t, 
 		const pxr::GfMatrix3f& rm,
 		const pxr::GfVec3f& s,
 		mat4& o_matrix);
 
+	// Bulk copy of GfVec3f data into float3, both are three tightly packed floats.
+	void CopyVec3f(
+		const pxr::GfVec3f* i_src,
+		const size_t i_count,
+		float3* o_dst);
+
+	// Smooth vertex normals from the adjacency table, computed in parallel
+	// and written straight into o_normals (i_numPoints entries).
+	void ComputeSmoothNormals(
+		const pxr::Hd_VertexAdjacency& i_adjacency,
+		const size_t i_numPoints,
+		const pxr::GfVec3f* i_points,
+		float3* o_normals);
+
 	void UpdateVertices(
 		HostMesh* i_mesh,
 		const std::vector<int>& tmpIndices,
@@ -28,6 +190,31 @@ namespace Lighthouse2Utils
 		const std::vector<float2>& tmpUvs, //facevarying
 		const int materialIdx);
 
+	// Rewrite positions, normals, alphas and tangents of an already built
+	// mesh in place. The triangle count must match the one it was built with.
+	void RefitFromIndexedData(
+		HostMesh* i_mesh,
+		const std::vector<int>& tmpIndices,
+		const std::vector<float3>& tmpVertices, // vertex
+		const std::vector<float3>& tmpNormals, // vertex
+		const bool hasUvs);
+
+	// Per-instance shading attributes, looked up by instance (node) ID so
+	// varying instances keep sharing one mesh and one material.
+	struct InstanceAttributes
+	{
+		float3 tint = make_float3(1, 1, 1); // multiplies the material color
+	};
+
+	// RenderAPI::SetNodeTransform for many nodes at once: writes the local
+	// transforms straight into the scene node pool, in parallel, so the
+	// scene graph update picks all of them up in one go. Node IDs must be
+	// distinct and valid.
+	void SetNodeTransforms(
+		HostScene* i_scene,
+		const std::vector<int>& nodeIDs,
+		const std::vector<mat4>& transforms);
+
 }
 
 #endif